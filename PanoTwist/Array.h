@@ -892,7 +892,7 @@ void CHArray<theType,intType>::Histogram(theType start, theType end, intType num
 	{
 		if(arr[i]>end || arr[i]<start) continue;	//point out of bounds
 		bin=(intType)( (arr[i]-start) * invStep);
-		result.arr[bin] + =1;						//Adding (resType)1
+		result.arr[bin] += 1;						//Adding (resType)1
 	}
 
 }
@@ -1551,8 +1551,15 @@ void CHArray<theType,intType>::Serialize(BArchive& archive)
 	}
 	else
 	{
-		intType newSize;
+		//A size that can't be read or is negative fails the archive instead of allocating
+		intType newSize=0;
 		archive>>newSize;
+		if(!archive.IsGood() || newSize<0)
+		{
+			archive.SetFailed();
+			ResizeArray(0);
+			return;
+		}
 		ResizeArray(newSize,true);
 	}
 	archive.HandleArray(arr,numPoints);
@@ -81,6 +81,15 @@ public:
 	bool IsStoring() const {return isStoring;};
 	bool IsLoading() const {return !isStoring;};
 
+	//False once a read or write has failed, or SetFailed() was called after reading something invalid
+	//Loading code should stop there and discard what it has read
+	bool IsGood() const {return isStoring ? !outStream->fail() : !inStream->fail();};
+	void SetFailed()
+	{
+		if(isStoring) outStream->setstate(std::ios::failbit);
+		else inStream->setstate(std::ios::failbit);
+	};
+
 	//Store or retrieve a value
 	template<class theType>
 	BArchive& operator<<(theType& val){return Store(val);};
@@ -167,8 +167,15 @@ public:
 
 		if (ar.IsLoading())
 		{
-			int newLength;
+			//A length that can't be read or is negative fails the archive instead of allocating
+			int newLength = 0;
 			ar >> newLength;
+			if (!ar.IsGood() || newLength < 0)
+			{
+				ar.SetFailed();
+				clear();
+				return;
+			}
 
 			char* buffer = new char[newLength + 1];
 			ar.RetrieveArray(buffer, newLength);
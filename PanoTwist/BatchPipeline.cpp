@@ -0,0 +1,164 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+#include "BatchPipeline.h"
+#include "BoundedQueue.h"
+#include "PanoProcessing.h"
+
+#include <thread>
+#include <vector>
+#include <memory>
+
+namespace
+{
+	//A file on its way through the pipeline
+	struct BatchItem
+	{
+		BatchItem() : index(-1) {}
+
+		int index;			//Index in the file lists
+		cv::Mat image;
+		std::vector<uchar> fileData;	//The encoded file, from the encoders to the taggers
+	};
+
+	//Starts numWorkers threads running workerFunction
+	//The last worker to exit closes outQueue, which lets the next stage finish once it is drained
+	void StartStage(int numWorkers,
+		std::function<void()> workerFunction,
+		BoundedQueue<BatchItem>* outQueue,
+		std::vector<std::thread>& threads)
+	{
+		if (numWorkers < 1) numWorkers = 1;
+		std::shared_ptr<std::atomic<int>> numRunning = std::make_shared<std::atomic<int>>(numWorkers);
+
+		for (int i = 0; i < numWorkers; i++)
+		{
+			threads.push_back(std::thread([=]()
+			{
+				workerFunction();
+				if (--(*numRunning) == 0 && outQueue) outQueue->Close();
+			}));
+		}
+	}
+}
+
+//Decoding and encoding JPEGs takes most of the time, processing, tagging and writing are comparatively cheap
+//Each decoded panorama can take hundreds of megabytes, so the queues are kept short
+BatchPipeline::Config BatchPipeline::DefaultConfig(int numCores)
+{
+	if (numCores <= 0) numCores = std::thread::hardware_concurrency();
+	if (numCores <= 0) numCores = 1;
+
+	Config config;
+	config.numDecoders = std::max(1, numCores * 3 / 8);
+	config.numEncoders = std::max(1, numCores * 3 / 8);
+	config.numProcessors = std::max(1, numCores / 8);
+	config.numTaggers = std::max(1, numCores / 8);
+	config.queueDepth = 2;
+
+	return config;
+}
+
+BatchPipeline::BatchPipeline(const Config& theConfig, ProcessingFunction theProcessingFunction, TagFunction theTagFunction) :
+config(theConfig),
+processingFunction(theProcessingFunction),
+tagFunction(theTagFunction)
+{
+}
+
+void BatchPipeline::Run(const CHArray<BString>& inFiles,
+	const CHArray<BString>& outFiles,
+	const std::atomic<bool>& fCancel,
+	FileFinishedFunction fileFinishedFunction)
+{
+	BoundedQueue<BatchItem> decodedQueue(config.queueDepth);
+	BoundedQueue<BatchItem> processedQueue(config.queueDepth);
+	BoundedQueue<BatchItem> encodedQueue(config.queueDepth);
+
+	std::atomic<int> nextIndex(0);
+	std::vector<std::thread> threads;
+
+	//Decode - each decoder takes the next file from the list
+	StartStage(config.numDecoders, [&]()
+	{
+		for (int i = nextIndex++; i < inFiles.Count() && !fCancel; i = nextIndex++)
+		{
+			bool fTagged;
+			if (directFunction && directFunction(inFiles[i], outFiles[i], fTagged)) { fileFinishedFunction(i, fTagged ? Saved : TagFailed, cv::Mat()); continue; }
+
+			BatchItem item;
+			item.index = i;
+			item.image = PanoProcessing::ReadImage(inFiles[i]);
+
+			//Something went wrong - maybe the user moved the file
+			if (item.image.empty()) { fileFinishedFunction(i, ReadFailed, item.image); continue; }
+
+			if (!decodedQueue.Push(std::move(item))) break;
+		}
+	}, &decodedQueue, threads);
+
+	//Process
+	StartStage(config.numProcessors, [&]()
+	{
+		BatchItem item;
+		while (decodedQueue.Pop(item))
+		{
+			if (fCancel) continue;
+
+			if (!processingFunction(item.image)) { fileFinishedFunction(item.index, Skipped, item.image); continue; }
+
+			processedQueue.Push(std::move(item));
+		}
+	}, &processedQueue, threads);
+
+	//Encode into memory
+	StartStage(config.numEncoders, [&]()
+	{
+		BatchItem item;
+		while (processedQueue.Pop(item))
+		{
+			if (fCancel) continue;
+
+			if (!PanoProcessing::EncodeImage(outFiles[item.index], item.image, item.fileData)) { fileFinishedFunction(item.index, WriteFailed, item.image); continue; }
+
+			encodedQueue.Push(std::move(item));
+		}
+	}, &encodedQueue, threads);
+
+	//Insert the panorama tags into the encoded files and write them
+	//A file whose tags could not be inserted is still written, and reported as TagFailed
+	StartStage(config.numTaggers, [&]()
+	{
+		BatchItem item;
+		while (encodedQueue.Pop(item))
+		{
+			if (fCancel) continue;
+
+			bool fTagged = tagFunction(item.fileData, item.image);
+			if (!PanoProcessing::WriteFileData(outFiles[item.index], item.fileData)) { fileFinishedFunction(item.index, WriteFailed, item.image); continue; }
+
+			fileFinishedFunction(item.index, fTagged ? Saved : TagFailed, item.image);
+		}
+	}, nullptr, threads);
+
+	for (auto& thread : threads) thread.join();
+}
@@ -0,0 +1,88 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+//Multi-threaded batch processing of panorama files
+//Files flow through four stages connected by bounded queues:
+//decode (imread) -> process -> encode (imencode, into memory) -> metadata (exif and XMP tags) and write
+//The tags are inserted into the encoded file in memory, so every file is written to disk once
+//Each stage has its own pool of worker threads, so disk I/O and codec work of different files overlap,
+//while the number of decoded images in memory is limited by the queue depth
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include "Array.h"
+
+#include <functional>
+#include <atomic>
+#include <vector>
+
+class BatchPipeline
+{
+public:
+	//Number of worker threads for each stage and the capacity of the queues between stages
+	struct Config
+	{
+		Config() : numDecoders(1), numProcessors(1), numEncoders(1), numTaggers(1), queueDepth(2) {}
+
+		int numDecoders;
+		int numProcessors;
+		int numEncoders;
+		int numTaggers;
+		int queueDepth;
+	};
+
+	//Splits the cores between the stages, giving most of them to the JPEG decoding and encoding
+	static Config DefaultConfig(int numCores = 0);
+
+	//What happened to a single file
+	enum FileStatus { Saved, Skipped, ReadFailed, WriteFailed, TagFailed };
+
+	//Returns false if the image should not be saved
+	typedef std::function<bool(cv::Mat&)> ProcessingFunction;
+	//Inserts tags into the encoded file before it is written, returns false on failure
+	typedef std::function<bool(std::vector<uchar>& fileData, const cv::Mat& image)> TagFunction;
+	//Called from the worker threads after each file, in the order in which the files finish
+	typedef std::function<void(int index, FileStatus status, const cv::Mat& image)> FileFinishedFunction;
+	//Saves and tags a file without decoding it, returns false if the file has to go through the pipeline
+	//fTagged receives whether the tags were written
+	typedef std::function<bool(const BString& inFile, const BString& outFile, bool& fTagged)> DirectFunction;
+
+public:
+	BatchPipeline(const Config& theConfig, ProcessingFunction theProcessingFunction, TagFunction theTagFunction);
+	~BatchPipeline(){}
+
+	//Tried by the decoders before decoding each file; files saved by it are reported with an empty image
+	void SetDirectFunction(DirectFunction theDirectFunction) { directFunction = theDirectFunction; }
+
+	//Processes inFiles[i] into outFiles[i] for all files, blocks until all stages finish
+	//Stops taking new files when fCancel becomes true; files already in flight are dropped
+	void Run(const CHArray<BString>& inFiles,
+		const CHArray<BString>& outFiles,
+		const std::atomic<bool>& fCancel,
+		FileFinishedFunction fileFinishedFunction);
+
+private:
+	Config config;
+	ProcessingFunction processingFunction;
+	TagFunction tagFunction;
+	DirectFunction directFunction;
+};
@@ -0,0 +1,540 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+
+//First, so that _FILE_OFFSET_BITS is defined before <cstdio> is included
+#include "fseek_large.h"
+
+#include "BigTiff.h"
+
+#include <algorithm>
+#include <climits>
+
+namespace
+{
+	//Tags and field types of the TIFF 6.0 and BigTIFF specifications
+	enum Tag
+	{
+		TagImageWidth = 256,
+		TagImageLength = 257,
+		TagBitsPerSample = 258,
+		TagCompression = 259,
+		TagPhotometric = 262,
+		TagStripOffsets = 273,
+		TagOrientation = 274,
+		TagSamplesPerPixel = 277,
+		TagRowsPerStrip = 278,
+		TagStripByteCounts = 279,
+		TagPlanarConfig = 284,
+		TagTileWidth = 322,
+		TagSampleFormat = 339,
+		TagXmp = 700
+	};
+
+	enum FieldType { TypeByte = 1, TypeShort = 3, TypeLong = 4, TypeLong8 = 16 };
+
+	const uint64_t maxValues = 1 << 24;			//More values than this in a tag means a broken file
+	const uint64_t maxClassicBytes = 0xFFFFFFFF;	//Classic TIFF offsets are 32-bit
+	const uint64_t writerStripBytes = 1 << 20;		//Strips of about 1 MB, a few rows of a big panorama
+
+	int TypeBytes(int type)
+	{
+		switch (type)
+		{
+		case TypeByte: return 1;
+		case TypeShort: return 2;
+		case TypeLong: return 4;
+		case TypeLong8: return 8;
+		default: return 0;
+		}
+	}
+
+	//Little-endian, which the writer always uses
+	void Put(std::vector<uint8_t>& bytes, uint64_t value, int numBytes)
+	{
+		for (int i = 0; i < numBytes; i++) bytes.push_back(uint8_t(value >> (8 * i)));
+	}
+
+	//A tag for the writer, with its values already in file order
+	struct Entry
+	{
+		Entry(int theTag, int theType, uint64_t theCount) : tag(theTag), type(theType), count(theCount), offset(0) {}
+
+		int tag;
+		int type;
+		uint64_t count;
+		std::vector<uint8_t> data;
+		uint64_t offset;		//Where the values are if they don't fit into the entry
+	};
+
+	Entry MakeEntry(int tag, int type, const std::vector<uint64_t>& values)
+	{
+		Entry entry(tag, type, values.size());
+		for (uint64_t value : values) Put(entry.data, value, TypeBytes(type));
+		return entry;
+	}
+}
+
+//Multi-byte values in the byte order of the file
+uint64_t BigTiff::Reader::Get(const uint8_t* p, int numBytes) const
+{
+	uint64_t value = 0;
+	for (int i = 0; i < numBytes; i++)
+	{
+		int shift = fBigEndian ? 8 * (numBytes - 1 - i) : 8 * i;
+		value |= uint64_t(p[i]) << shift;
+	}
+	return value;
+}
+
+//The values of a directory entry of an integer type, which are inside the entry if they fit
+bool BigTiff::Reader::ReadValues(const uint8_t* entry, bool fBigTiff, std::vector<uint64_t>& values)
+{
+	int type = int(Get(entry + 2, 2));
+	int typeBytes = TypeBytes(type);
+	uint64_t count = fBigTiff ? Get(entry + 4, 8) : Get(entry + 4, 4);
+	if (typeBytes == 0 || count == 0 || count > maxValues) return false;
+
+	int fieldBytes = fBigTiff ? 8 : 4;
+	const uint8_t* field = entry + (fBigTiff ? 12 : 8);
+
+	std::vector<uint8_t> data;
+	if (count * typeBytes <= uint64_t(fieldBytes))
+	{
+		data.assign(field, field + fieldBytes);
+	}
+	else
+	{
+		data.resize(size_t(count * typeBytes));
+		if (fseek_large(file, int64_t(Get(field, fieldBytes)), SEEK_SET) != 0) return false;
+		if (fread(data.data(), 1, data.size(), file) != data.size()) return false;
+	}
+
+	values.resize(size_t(count));
+	for (size_t i = 0; i < values.size(); i++) values[i] = Get(&data[i * typeBytes], typeBytes);
+	return true;
+}
+
+//Only the first image of the file is read
+bool BigTiff::Reader::Open(const BString& filename)
+{
+	Close();
+
+	file = fopen(filename.c_str(), "rb");
+	if (!file) return false;
+
+	//Closes the file on every failure below
+	auto fail = [&]()
+	{
+		Close();
+		return false;
+	};
+
+	uint8_t header[16];
+	if (fread(header, 1, 8, file) != 8) return fail();
+
+	if (header[0] == 'I' && header[1] == 'I') fBigEndian = false;
+	else if (header[0] == 'M' && header[1] == 'M') fBigEndian = true;
+	else return fail();
+
+	//Version 42 is classic TIFF, 43 is BigTIFF with 8-byte offsets
+	bool fBigTiff;
+	uint64_t directoryOffset;
+	int version = int(Get(header + 2, 2));
+	if (version == 42)
+	{
+		fBigTiff = false;
+		directoryOffset = Get(header + 4, 4);
+	}
+	else if (version == 43)
+	{
+		fBigTiff = true;
+		if (Get(header + 4, 2) != 8 || fread(header + 8, 1, 8, file) != 8) return fail();
+		directoryOffset = Get(header + 8, 8);
+	}
+	else return fail();
+
+	int countBytes = fBigTiff ? 8 : 2;
+	int entryBytes = fBigTiff ? 20 : 12;
+
+	uint8_t countData[8];
+	if (fseek_large(file, int64_t(directoryOffset), SEEK_SET) != 0 || fread(countData, 1, countBytes, file) != size_t(countBytes)) return fail();
+
+	uint64_t numEntries = Get(countData, countBytes);
+	if (numEntries == 0 || numEntries > 4096) return fail();
+
+	std::vector<uint8_t> entries(size_t(numEntries * entryBytes));
+	if (fread(entries.data(), 1, entries.size(), file) != entries.size()) return fail();
+
+	//Defaults of the TIFF specification; there is no default for the photometric interpretation
+	uint64_t width = 0, height = 0, compression = 1, photometric = 0xFFFF, orientation = 1, planarConfig = 1;
+	uint64_t rowsPerStripTag = 0xFFFFFFFF;
+	std::vector<uint64_t> bitsPerSample(1, 1), sampleFormat(1, 1), samples(1, 1), byteCounts, values;
+
+	for (uint64_t k = 0; k < numEntries; k++)
+	{
+		const uint8_t* entry = &entries[size_t(k * entryBytes)];
+
+		switch (Get(entry, 2))
+		{
+		case TagImageWidth:			if (!ReadValues(entry, fBigTiff, values)) return fail(); width = values[0]; break;
+		case TagImageLength:		if (!ReadValues(entry, fBigTiff, values)) return fail(); height = values[0]; break;
+		case TagBitsPerSample:		if (!ReadValues(entry, fBigTiff, bitsPerSample)) return fail(); break;
+		case TagCompression:		if (!ReadValues(entry, fBigTiff, values)) return fail(); compression = values[0]; break;
+		case TagPhotometric:		if (!ReadValues(entry, fBigTiff, values)) return fail(); photometric = values[0]; break;
+		case TagStripOffsets:		if (!ReadValues(entry, fBigTiff, stripOffsets)) return fail(); break;
+		case TagOrientation:		if (!ReadValues(entry, fBigTiff, values)) return fail(); orientation = values[0]; break;
+		case TagSamplesPerPixel:	if (!ReadValues(entry, fBigTiff, samples)) return fail(); break;
+		case TagRowsPerStrip:		if (!ReadValues(entry, fBigTiff, values)) return fail(); rowsPerStripTag = values[0]; break;
+		case TagStripByteCounts:	if (!ReadValues(entry, fBigTiff, byteCounts)) return fail(); break;
+		case TagPlanarConfig:		if (!ReadValues(entry, fBigTiff, values)) return fail(); planarConfig = values[0]; break;
+		case TagSampleFormat:		if (!ReadValues(entry, fBigTiff, sampleFormat)) return fail(); break;
+		case TagTileWidth:			return fail();		//Tiled files are left to cv::imread
+		}
+	}
+
+	//cv::imread applies the orientation, and only 8-bit unsigned integer samples are read as they are
+	if (width == 0 || height == 0 || width > INT_MAX || height > INT_MAX) return fail();
+	if (compression != 1 || orientation != 1 || planarConfig != 1) return fail();
+	for (uint64_t bits : bitsPerSample) if (bits != 8) return fail();
+	for (uint64_t format : sampleFormat) if (format != 1) return fail();
+
+	//Gray (min is black), RGB and RGB with alpha
+	samplesPerPixel = int(samples[0]);
+	if (!(samplesPerPixel == 1 && photometric == 1) && !((samplesPerPixel == 3 || samplesPerPixel == 4) && photometric == 2)) return fail();
+
+	size = cv::Size(int(width), int(height));
+	rowsPerStrip = int(std::min(rowsPerStripTag, height));
+	if (rowsPerStrip == 0) return fail();
+
+	uint64_t numStrips = (height + rowsPerStrip - 1) / rowsPerStrip;
+	if (stripOffsets.size() != numStrips || byteCounts.size() != numStrips) return fail();
+
+	//Every strip must be in the file, uncompressed
+	if (fseek_large(file, 0, SEEK_END) != 0) return fail();
+	uint64_t fileBytes = uint64_t(ftell_large(file));
+
+	uint64_t rowBytes = width * samplesPerPixel;
+	for (uint64_t s = 0; s < numStrips; s++)
+	{
+		uint64_t stripBytes = std::min<uint64_t>(rowsPerStrip, height - s * rowsPerStrip) * rowBytes;
+		if (byteCounts[s] < stripBytes || stripOffsets[s] > fileBytes || fileBytes - stripOffsets[s] < stripBytes) return fail();
+	}
+
+	nextRow = 0;
+	return true;
+}
+
+void BigTiff::Reader::Close()
+{
+	if (file) fclose(file);
+	file = nullptr;
+	size = cv::Size();
+	stripOffsets.clear();
+	buffer.clear();
+}
+
+//Reads the rows a strip at a time, into a buffer of at most the requested rows
+bool BigTiff::Reader::ReadRows(cv::Mat& rows)
+{
+	if (!file || rows.type() != CV_8UC3 || rows.cols != size.width || rows.rows > size.height - nextRow) return false;
+
+	int conversion = (samplesPerPixel == 1) ? cv::COLOR_GRAY2BGR : (samplesPerPixel == 3) ? cv::COLOR_RGB2BGR : cv::COLOR_RGBA2BGR;
+	size_t rowBytes = size_t(size.width) * samplesPerPixel;
+
+	for (int i = 0; i < rows.rows;)
+	{
+		int strip = nextRow / rowsPerStrip;
+		int stripRow = nextRow % rowsPerStrip;
+		int numRows = std::min(rows.rows - i, rowsPerStrip - stripRow);
+
+		buffer.resize(numRows * rowBytes);
+		if (fseek_large(file, int64_t(stripOffsets[strip] + stripRow * rowBytes), SEEK_SET) != 0) return false;
+		if (fread(buffer.data(), 1, buffer.size(), file) != buffer.size()) return false;
+
+		cv::Mat data(numRows, size.width, CV_8UC(samplesPerPixel), buffer.data());
+		cv::Mat dst = rows.rowRange(i, i + numRows);
+		cv::cvtColor(data, dst, conversion);
+
+		i += numRows;
+		nextRow += numRows;
+	}
+
+	return true;
+}
+
+BigTiff::Writer::~Writer()
+{
+	if (file) Abandon();
+}
+
+//The header is written with a zero directory offset, Close() fills it in
+bool BigTiff::Writer::Open(const BString& theFilename, cv::Size theSize, const std::string& theXmpPacket)
+{
+	if (file) Abandon();
+	if (theSize.width <= 0 || theSize.height <= 0) return false;
+
+	filename = theFilename;
+	size = theSize;
+	xmpPacket = theXmpPacket;
+	nextRow = 0;
+
+	uint64_t rowBytes = uint64_t(size.width) * 3;
+	rowsPerStrip = int(std::max<uint64_t>(1, std::min<uint64_t>(size.height, writerStripBytes / rowBytes)));
+	uint64_t numStrips = (uint64_t(size.height) + rowsPerStrip - 1) / rowsPerStrip;
+
+	//Header, image data, the values of the tags and the directory, with room to spare
+	uint64_t fileBytes = 8 + rowBytes * size.height + xmpPacket.size() + numStrips * 8 + 4096;
+	fBigTiff = fileBytes > maxClassicBytes;
+
+	file = fopen(filename.c_str(), "wb");
+	if (!file) return false;
+
+	std::vector<uint8_t> header;
+	Put(header, 'I' | ('I' << 8), 2);
+	if (fBigTiff)
+	{
+		Put(header, 43, 2);
+		Put(header, 8, 2);
+		Put(header, 0, 2);
+		Put(header, 0, 8);
+	}
+	else
+	{
+		Put(header, 42, 2);
+		Put(header, 0, 4);
+	}
+
+	if (fwrite(header.data(), 1, header.size(), file) != header.size())
+	{
+		Abandon();
+		return false;
+	}
+
+	return true;
+}
+
+bool BigTiff::Writer::WriteRows(const cv::Mat& rows)
+{
+	if (!file || rows.type() != CV_8UC3 || rows.cols != size.width || rows.rows > size.height - nextRow) return false;
+
+	cv::cvtColor(rows, rgbRows, cv::COLOR_BGR2RGB);
+
+	size_t numBytes = rgbRows.total() * rgbRows.elemSize();
+	if (fwrite(rgbRows.data, 1, numBytes, file) != numBytes) return false;
+
+	nextRow += rows.rows;
+	return true;
+}
+
+//Strips are written back to back from the end of the header, so their offsets follow from the row size
+//Tag values that don't fit into their entries go after the image data, at even offsets, then the directory
+bool BigTiff::Writer::Close()
+{
+	if (!file) return false;
+	if (nextRow != size.height)
+	{
+		Abandon();
+		return false;
+	}
+
+	uint64_t headerBytes = fBigTiff ? 16 : 8;
+	uint64_t rowBytes = uint64_t(size.width) * 3;
+	uint64_t numStrips = (uint64_t(size.height) + rowsPerStrip - 1) / rowsPerStrip;
+
+	std::vector<uint64_t> stripOffsets(numStrips);
+	std::vector<uint64_t> stripByteCounts(numStrips);
+	for (uint64_t s = 0; s < numStrips; s++)
+	{
+		uint64_t firstRow = s * rowsPerStrip;
+		stripOffsets[s] = headerBytes + firstRow * rowBytes;
+		stripByteCounts[s] = std::min<uint64_t>(rowsPerStrip, size.height - firstRow) * rowBytes;
+	}
+
+	int offsetType = fBigTiff ? TypeLong8 : TypeLong;
+
+	//In the increasing order of the tags
+	std::vector<Entry> entries;
+	entries.push_back(MakeEntry(TagImageWidth, TypeLong, { uint64_t(size.width) }));
+	entries.push_back(MakeEntry(TagImageLength, TypeLong, { uint64_t(size.height) }));
+	entries.push_back(MakeEntry(TagBitsPerSample, TypeShort, { 8, 8, 8 }));
+	entries.push_back(MakeEntry(TagCompression, TypeShort, { 1 }));
+	entries.push_back(MakeEntry(TagPhotometric, TypeShort, { 2 }));
+	entries.push_back(MakeEntry(TagStripOffsets, offsetType, stripOffsets));
+	entries.push_back(MakeEntry(TagSamplesPerPixel, TypeShort, { 3 }));
+	entries.push_back(MakeEntry(TagRowsPerStrip, TypeLong, { uint64_t(rowsPerStrip) }));
+	entries.push_back(MakeEntry(TagStripByteCounts, offsetType, stripByteCounts));
+	entries.push_back(MakeEntry(TagPlanarConfig, TypeShort, { 1 }));
+	if (!xmpPacket.empty())
+	{
+		Entry xmp(TagXmp, TypeByte, xmpPacket.size());
+		xmp.data.assign(xmpPacket.begin(), xmpPacket.end());
+		entries.push_back(xmp);
+	}
+
+	int countBytes = fBigTiff ? 8 : 2;
+	int fieldBytes = fBigTiff ? 8 : 4;
+
+	uint64_t pos = headerBytes + rowBytes * size.height;
+	std::vector<uint8_t> tail;
+	auto align = [&]()
+	{
+		if ((pos + tail.size()) % 2 != 0) tail.push_back(0);
+	};
+
+	align();
+	for (Entry& entry : entries)
+	{
+		if (entry.data.size() <= size_t(fieldBytes)) continue;
+
+		entry.offset = pos + tail.size();
+		tail.insert(tail.end(), entry.data.begin(), entry.data.end());
+		align();
+	}
+
+	uint64_t directoryOffset = pos + tail.size();
+	Put(tail, entries.size(), countBytes);
+	for (const Entry& entry : entries)
+	{
+		Put(tail, entry.tag, 2);
+		Put(tail, entry.type, 2);
+		Put(tail, entry.count, fieldBytes);
+
+		if (entry.data.size() <= size_t(fieldBytes))
+		{
+			tail.insert(tail.end(), entry.data.begin(), entry.data.end());
+			tail.resize(tail.size() + fieldBytes - entry.data.size(), 0);
+		}
+		else Put(tail, entry.offset, fieldBytes);
+	}
+	Put(tail, 0, fieldBytes);		//No next directory
+
+	if (!fBigTiff && directoryOffset + tail.size() > maxClassicBytes)
+	{
+		Abandon();
+		return false;
+	}
+
+	std::vector<uint8_t> offsetData;
+	Put(offsetData, directoryOffset, fieldBytes);
+
+	bool fWritten = fwrite(tail.data(), 1, tail.size(), file) == tail.size() &&
+					fseek_large(file, fBigTiff ? 8 : 4, SEEK_SET) == 0 &&
+					fwrite(offsetData.data(), 1, offsetData.size(), file) == offsetData.size();
+
+	//Write errors of the last buffer only show up in fclose
+	FILE* closing = file;
+	file = nullptr;
+	if (fclose(closing) != 0 || !fWritten)
+	{
+		remove(filename.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+void BigTiff::Writer::Abandon()
+{
+	fclose(file);
+	file = nullptr;
+	remove(filename.c_str());
+}
+
+bool BigTiff::ReadImageHeader(const BString& filename, ImageHeader& header)
+{
+	header = ImageHeader();
+
+	Reader reader;
+	if (!reader.Open(filename)) return false;
+
+	header.width = reader.Size().width;
+	header.height = reader.Size().height;
+	return true;
+}
+
+//Whole groups of factor rows are averaged, like the reduced decoding of a JPEG; the rows left over at the bottom are dropped
+cv::Mat BigTiff::ReadReduced(const BString& filename, cv::Size minSize, cv::Size& fullSize)
+{
+	Reader reader;
+	if (!reader.Open(filename)) return cv::Mat();
+
+	fullSize = reader.Size();
+
+	//Largest reduction first, as in PanoProcessing::ReadReduced()
+	int factor = 1;
+	const int factors[3] = { 8, 4, 2 };
+	for (int k = 0; k < 3 && factor == 1; k++)
+	{
+		if (fullSize.width / factors[k] >= minSize.width && fullSize.height / factors[k] >= minSize.height) factor = factors[k];
+	}
+
+	const int reducedRowsPerRead = 16;
+	cv::Mat reduced(fullSize.height / factor, fullSize.width / factor, CV_8UC3);
+	cv::Mat rows;
+
+	for (int i = 0; i < reduced.rows; i += reducedRowsPerRead)
+	{
+		int numRows = std::min(reducedRowsPerRead, reduced.rows - i);
+		rows.create(numRows * factor, fullSize.width, CV_8UC3);
+		if (!reader.ReadRows(rows)) return cv::Mat();
+
+		cv::Mat dst = reduced.rowRange(i, i + numRows);
+		if (factor == 1) rows.copyTo(dst);
+		else cv::resize(rows.colRange(0, reduced.cols * factor), dst, dst.size(), 0, 0, cv::INTER_AREA);
+	}
+
+	return reduced;
+}
+
+bool BigTiff::ProcessFile(const BString& srcFilename, const BString& dstFilename, double rotationRad,
+	const RescaleSettings& rescale, const PatchSettings& nadir, const PatchSettings& zenith, cv::Size& size, bool& fTagged)
+{
+	size = cv::Size();
+	fTagged = false;
+
+	Reader reader;
+	if (!reader.Open(srcFilename)) return false;
+
+	cv::Size srcSize = reader.Size();
+	if (!PanoProcessing::CanProcessInStrips(srcSize, rescale, nadir, zenith)) return false;
+	if (reader.IsGray() && !PanoProcessing::IsTooBigToDecode(srcSize)) return false;
+
+	cv::Size outSize = PanoProcessing::RescaledSize(srcSize, rescale);
+
+	std::string xmpPacket = PanoProcessing::PanoramaXmpPacket(outSize);
+
+	Writer writer;
+	if (!writer.Open(dstFilename, outSize, xmpPacket)) return false;
+
+	bool fDone = PanoProcessing::ProcessStrips(srcSize,
+		[&](cv::Mat& rows) { return reader.ReadRows(rows); },
+		[&](const cv::Mat& rows) { return writer.WriteRows(rows); },
+		rotationRad, rescale, nadir, zenith);
+
+	//The writer deletes the file if it is not closed
+	if (!fDone || !writer.Close()) return false;
+
+	size = outSize;
+	fTagged = !xmpPacket.empty();
+	return true;
+}
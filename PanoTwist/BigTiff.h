@@ -0,0 +1,122 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+
+//Reading and writing uncompressed TIFF and BigTIFF files a strip of rows at a time, with 64-bit file offsets
+//cv::imread refuses images of more than 2^30 pixels and cv::imwrite writes classic TIFF with 32-bit offsets,
+//so panoramas bigger than that go through this reader and writer instead, and never have to be in memory as a whole
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include "BString.h"
+#include "PanoProcessing.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+
+namespace BigTiff
+{
+	//Reads the image of an uncompressed, 8-bit, chunky, stripped TIFF or BigTIFF file from top to bottom
+	//Gray, RGB and RGBA files are read as BGR, like cv::imread does without IMREAD_ANYCOLOR
+	class Reader
+	{
+	public:
+		Reader() : file(nullptr), fBigEndian(false), samplesPerPixel(0), rowsPerStrip(0), nextRow(0) {}
+		~Reader() { Close(); }
+
+		//Returns false unless the file is a TIFF of the kind above, without an orientation to apply
+		bool Open(const BString& filename);
+		void Close();
+
+		cv::Size Size() const { return size; }
+		bool IsGray() const { return samplesPerPixel == 1; }
+
+		//Reads the next rows.rows rows into rows, which must be CV_8UC3 and Size().width wide
+		bool ReadRows(cv::Mat& rows);
+
+	private:
+		Reader(const Reader&);
+		Reader& operator=(const Reader&);
+
+		uint64_t Get(const uint8_t* p, int numBytes) const;
+		bool ReadValues(const uint8_t* entry, bool fBigTiff, std::vector<uint64_t>& values);
+
+	private:
+		FILE* file;
+		bool fBigEndian;
+		cv::Size size;
+		int samplesPerPixel;
+		int rowsPerStrip;
+		std::vector<uint64_t> stripOffsets;
+		int nextRow;
+		std::vector<uint8_t> buffer;
+	};
+
+	//Writes an uncompressed 8-bit RGB TIFF from top to bottom, BigTIFF only if the file would be bigger than 4 GB
+	class Writer
+	{
+	public:
+		Writer() : file(nullptr), fBigTiff(false), rowsPerStrip(0), nextRow(0) {}
+		~Writer();
+
+		//xmpPacket is written into the XMP tag, if it is not empty
+		bool Open(const BString& theFilename, cv::Size theSize, const std::string& theXmpPacket);
+
+		//Takes the next rows of the image, CV_8UC3 BGR like cv::imwrite
+		bool WriteRows(const cv::Mat& rows);
+
+		//Writes the tags once all rows are in; the file is deleted if this fails or is never called
+		bool Close();
+
+	private:
+		Writer(const Writer&);
+		Writer& operator=(const Writer&);
+
+		void Abandon();
+
+	private:
+		FILE* file;
+		BString filename;
+		bool fBigTiff;
+		cv::Size size;
+		std::string xmpPacket;
+		int rowsPerStrip;
+		int nextRow;
+		cv::Mat rgbRows;
+	};
+
+	//The size of a file that Reader can read, for files Exiv2 can't open
+	bool ReadImageHeader(const BString& filename, ImageHeader& header);
+
+	//Same as PanoProcessing::ReadReduced(), for files that Reader can read; returns an empty image for other files
+	cv::Mat ReadReduced(const BString& filename, cv::Size minSize, cv::Size& fullSize);
+
+	//Same pixels as cv::imread, PanoProcessing::Process() and cv::imwrite, with the image read and written in strips
+	//The GPano XMP of PanoProcessing::InsertExifTags() is written with the image, so that does not have to be called
+	//size receives the size of the result, fTagged whether the XMP could be made
+	//Returns false if Reader can't read the file, PanoProcessing::CanProcessInStrips() is false,
+	//or the file is gray and can be decoded, which keeps it gray; nothing is written then
+	//Gray files too big to decode come out in color
+	bool ProcessFile(const BString& srcFilename, const BString& dstFilename, double rotationRad,
+		const RescaleSettings& rescale, const PatchSettings& nadir, const PatchSettings& zenith, cv::Size& size, bool& fTagged);
+}
@@ -0,0 +1,198 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cstring>
+
+#if CV_SSE2
+#include <emmintrin.h>
+#endif
+
+//Bilinear sampling of an image at precomputed points, many pixels per call
+//A point is kept as a tap - the top left pixel of its 2x2 neighbourhood and the 5-bit fractions of the distances to it,
+//the same fixed-point weights cv::remap uses for INTER_LINEAR, so 8-bit results are identical to it
+//Borders are dealt with when the taps are made, so the inner loop neither checks nor reflects coordinates
+namespace BilinearSampler
+{
+	const int fractionBits = 5;
+	const int fractionScale = 1 << fractionBits;
+	const int weightBits = 2 * fractionBits;		//The four weights of a tap add up to 1 << weightBits
+
+	struct Tap
+	{
+		int pixel;				//Index of the top left pixel of the neighbourhood, y * cols + x
+		uchar tx, ty;			//Distances to it, in 1/fractionScale of a pixel, up to fractionScale
+		ushort unused;
+	};
+
+	//Taps are stored in cv::Mat of this type, so that copies of a table share the data
+	const int tapType = CV_32SC2;
+
+	//Tap for the point (x, y) of an image of the given size, at least 2x2
+	//Points are clamped to the image; one on the last row or column gets the full weight of the next pixel
+	//of the row or column before it, so the whole neighbourhood is always inside the image
+	inline Tap MakeTap(float x, float y, cv::Size size)
+	{
+		int xi = std::min(std::max(cvRound(x * fractionScale), 0), (size.width - 1) * fractionScale);
+		int yi = std::min(std::max(cvRound(y * fractionScale), 0), (size.height - 1) * fractionScale);
+
+		int x0 = xi >> fractionBits;
+		int y0 = yi >> fractionBits;
+		int tx = xi & (fractionScale - 1);
+		int ty = yi & (fractionScale - 1);
+
+		if (x0 == size.width - 1) { x0--; tx = fractionScale; }
+		if (y0 == size.height - 1) { y0--; ty = fractionScale; }
+
+		Tap tap;
+		tap.pixel = y0 * size.width + x0;
+		tap.tx = uchar(tx);
+		tap.ty = uchar(ty);
+		tap.unused = 0;
+		return tap;
+	}
+
+	//Weighted sum of the neighbourhood; integers are rounded to nearest like cv::remap does
+	template<typename T> inline T Blend(T p00, T p10, T p01, T p11, int w00, int w10, int w01, int w11)
+	{
+		return T((p00 * w00 + p10 * w10 + p01 * w01 + p11 * w11 + (1 << (weightBits - 1))) >> weightBits);
+	}
+
+	template<> inline float Blend<float>(float p00, float p10, float p01, float p11, int w00, int w10, int w01, int w11)
+	{
+		return (p00 * w00 + p10 * w10 + p01 * w01 + p11 * w11) * (1.f / (1 << weightBits));
+	}
+
+	//Samples count pixels of cn channels from src, an image srcCols pixels wide, into dst
+	template<typename T, int cn> void SampleRowScalar(const T* src, int srcCols, const Tap* taps, T* dst, int count)
+	{
+		size_t rowStep = size_t(srcCols) * cn;
+
+		for (int k = 0; k < count; k++, dst += cn)
+		{
+			const T* p0 = src + size_t(taps[k].pixel) * cn;
+			const T* p1 = p0 + rowStep;
+
+			int w11 = taps[k].tx * taps[k].ty;
+			int w10 = (taps[k].tx << fractionBits) - w11;
+			int w01 = (taps[k].ty << fractionBits) - w11;
+			int w00 = (1 << weightBits) - w10 - w01 - w11;
+
+			for (int c = 0; c < cn; c++) dst[c] = Blend<T>(p0[c], p0[c + cn], p1[c], p1[c + cn], w00, w10, w01, w11);
+		}
+	}
+
+	template<typename T, int cn> inline void SampleRow(const T* src, int srcCols, const Tap* taps, T* dst, int count)
+	{
+		SampleRowScalar<T, cn>(src, srcCols, taps, dst, count);
+	}
+
+#if CV_SSE2
+	//Both pixels of a row of the neighbourhood, channel by channel, as 16-bit pairs: p0c0 p1c0 p0c1 p1c1 p0c2 p1c2 x x
+	//The second pixel is read from two bytes on and shifted down, so nothing past the neighbourhood is read
+	inline __m128i LoadPairs8u3(const uchar* p)
+	{
+		int first, second;
+		memcpy(&first, p, 4);
+		memcpy(&second, p + 2, 4);
+
+		__m128i pairs = _mm_unpacklo_epi8(_mm_cvtsi32_si128(first), _mm_cvtsi32_si128(int(unsigned(second) >> 8)));
+		return _mm_unpacklo_epi8(pairs, _mm_setzero_si128());
+	}
+
+	//Channel sums of one pixel in 32-bit lanes, the fourth lane is junk
+	inline __m128i SamplePixel8u3(const uchar* src, size_t rowStep, const Tap& tap)
+	{
+		const uchar* p0 = src + size_t(tap.pixel) * 3;
+
+		int w11 = tap.tx * tap.ty;
+		int w10 = (tap.tx << fractionBits) - w11;
+		int w01 = (tap.ty << fractionBits) - w11;
+		int w00 = (1 << weightBits) - w10 - w01 - w11;
+
+		__m128i top = _mm_madd_epi16(LoadPairs8u3(p0), _mm_set1_epi32(w00 | (w10 << 16)));
+		__m128i bottom = _mm_madd_epi16(LoadPairs8u3(p0 + rowStep), _mm_set1_epi32(w01 | (w11 << 16)));
+		return _mm_add_epi32(top, bottom);
+	}
+
+	//Four pixels at a time, each written as four bytes, the fourth of which the next pixel overwrites
+	//The last pixel of the row is left to the scalar loop, so nothing is written past the row
+	template<> inline void SampleRow<uchar, 3>(const uchar* src, int srcCols, const Tap* taps, uchar* dst, int count)
+	{
+		size_t rowStep = size_t(srcCols) * 3;
+		const __m128i half = _mm_set1_epi32(1 << (weightBits - 1));
+
+		int k = 0;
+		for (; k + 4 < count; k += 4)
+		{
+			__m128i s0 = _mm_srli_epi32(_mm_add_epi32(SamplePixel8u3(src, rowStep, taps[k]), half), weightBits);
+			__m128i s1 = _mm_srli_epi32(_mm_add_epi32(SamplePixel8u3(src, rowStep, taps[k + 1]), half), weightBits);
+			__m128i s2 = _mm_srli_epi32(_mm_add_epi32(SamplePixel8u3(src, rowStep, taps[k + 2]), half), weightBits);
+			__m128i s3 = _mm_srli_epi32(_mm_add_epi32(SamplePixel8u3(src, rowStep, taps[k + 3]), half), weightBits);
+
+			__m128i bytes = _mm_packus_epi16(_mm_packs_epi32(s0, s1), _mm_packs_epi32(s2, s3));
+
+			uchar* d = dst + k * 3;
+			int pixel;
+			pixel = _mm_cvtsi128_si32(bytes);						memcpy(d, &pixel, 4);
+			pixel = _mm_cvtsi128_si32(_mm_srli_si128(bytes, 4));	memcpy(d + 3, &pixel, 4);
+			pixel = _mm_cvtsi128_si32(_mm_srli_si128(bytes, 8));	memcpy(d + 6, &pixel, 4);
+			pixel = _mm_cvtsi128_si32(_mm_srli_si128(bytes, 12));	memcpy(d + 9, &pixel, 4);
+		}
+
+		SampleRowScalar<uchar, 3>(src, srcCols, taps + k, dst + k * 3, count - k);
+	}
+#endif
+
+	template<typename T, int cn> void SampleRows(const cv::Mat& src, const cv::Mat& taps, cv::Mat& dst)
+	{
+		for (int i = 0; i < dst.rows; i++)
+		{
+			SampleRow<T, cn>(src.ptr<T>(), src.cols, taps.ptr<Tap>(i), dst.ptr<T>(i), dst.cols);
+		}
+	}
+
+	//Samples src at the taps into dst of the same size as the table, with a kernel specialized for the pixel type
+	//src must be continuous, at least 2x2 and of the same type as dst; returns false for types without a kernel
+	inline bool Sample(const cv::Mat& src, const cv::Mat& taps, cv::Mat& dst)
+	{
+		if (!src.isContinuous() || src.type() != dst.type() || taps.size() != dst.size() || taps.type() != tapType) return false;
+
+		switch (dst.type())
+		{
+		case CV_8UC1:	SampleRows<uchar, 1>(src, taps, dst);	return true;
+		case CV_8UC3:	SampleRows<uchar, 3>(src, taps, dst);	return true;
+		case CV_8UC4:	SampleRows<uchar, 4>(src, taps, dst);	return true;
+		case CV_16UC1:	SampleRows<ushort, 1>(src, taps, dst);	return true;
+		case CV_16UC3:	SampleRows<ushort, 3>(src, taps, dst);	return true;
+		case CV_16UC4:	SampleRows<ushort, 4>(src, taps, dst);	return true;
+		case CV_32FC1:	SampleRows<float, 1>(src, taps, dst);	return true;
+		case CV_32FC3:	SampleRows<float, 3>(src, taps, dst);	return true;
+		case CV_32FC4:	SampleRows<float, 4>(src, taps, dst);	return true;
+		default:		return false;
+		}
+	}
+}
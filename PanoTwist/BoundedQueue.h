@@ -0,0 +1,78 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+//A thread-safe FIFO queue with limited capacity, used to connect the stages of BatchPipeline
+//Push() blocks while the queue is full, Pop() blocks while it is empty
+//After Close(), Push() fails and Pop() returns the remaining items, then fails
+template<class theType>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(int theCapacity) : capacity(theCapacity < 1 ? 1 : theCapacity), fClosed(false) {}
+
+	//Returns false if the queue was closed
+	bool Push(theType&& item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		notFull.wait(lock, [this]{ return fClosed || int(items.size()) < capacity; });
+		if (fClosed) return false;
+
+		items.push_back(std::move(item));
+		notEmpty.notify_one();
+		return true;
+	}
+
+	//Returns false if the queue is closed and empty
+	bool Pop(theType& item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		notEmpty.wait(lock, [this]{ return fClosed || !items.empty(); });
+		if (items.empty()) return false;
+
+		item = std::move(items.front());
+		items.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+
+	void Close()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		fClosed = true;
+		notFull.notify_all();
+		notEmpty.notify_all();
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable notFull;
+	std::condition_variable notEmpty;
+	std::deque<theType> items;
+	const int capacity;
+	bool fClosed;
+};
@@ -58,7 +58,7 @@ class CvImageWidget : public QWidget
 public:
 	//The parent should be a frame or a scroll area
 	//CvImageVidget will set a layout to it
-	CvImageWidget(QWidget *parent) : QWidget(parent)
+	CvImageWidget(QWidget *parent) : QWidget(parent), wrapOffset(0), wrapFirstRow(0), wrapLastRow(0), crosshairLength(0), crosshairThickness(0)
 	{
 		QVBoxLayout* vLayout = new QVBoxLayout();
 		parent->setLayout(vLayout);
@@ -130,8 +130,13 @@ signals:
 public slots:
 	void ShowImage(const cv::Mat& image)
 	{
-		if (image.type() == CV_8UC3) cvtColor(image, mat, CV_BGR2RGB);
-		else if (image.type() == CV_8UC1) cvtColor(image, mat, CV_GRAY2RGB);
+		//16-bit and float images are shown in 8 bits, HDR values brighter than white are clipped
+		cv::Mat shown = image;
+		if (image.depth() == CV_16U) image.convertTo(shown, CV_8U, 1. / 257.);
+		else if (image.depth() == CV_32F) image.convertTo(shown, CV_8U, 255.);
+
+		if (shown.type() == CV_8UC3) cvtColor(shown, mat, CV_BGR2RGB);
+		else if (shown.type() == CV_8UC1) cvtColor(shown, mat, CV_GRAY2RGB);
 
 		qImage = QImage(mat.data, mat.cols, mat.rows, mat.cols * 3, QImage::Format_RGB888);
 		setFixedSize(image.cols, image.rows);
@@ -186,14 +191,76 @@ public slots:
 
 	void Clear() { ShowImage(cv::Mat(0, 0, CV_8UC3)); }
 
+	//Rows [firstRow, lastRow) of the image are drawn cyclically shifted right by offset pixels, the rest as is
+	//The shown image is not touched, so this is cheap enough for every mouse move
+	void SetWrapOffset(int offset, int firstRow, int lastRow)
+	{
+		if (offset == wrapOffset && firstRow == wrapFirstRow && lastRow == wrapLastRow) return;
+
+		wrapOffset = offset;
+		wrapFirstRow = firstRow;
+		wrapLastRow = lastRow;
+		update();
+	}
+
+	//A cross in the center of the image, drawn over it when painting; length 0 turns it off
+	void SetCrosshair(int length, int thickness, const QColor& color)
+	{
+		crosshairLength = length;
+		crosshairThickness = thickness;
+		crosshairColor = color;
+		update();
+	}
+
 protected:
+	//The wrapped rows are drawn as two blits of the cached QImage
 	void paintEvent(QPaintEvent*)
 	{
 		QPainter painter(this);
-		painter.drawImage(QPoint(0, 0), qImage);
+
+		int cols = qImage.width();
+		int rows = qImage.height();
+		int firstRow = std::max(0, std::min(wrapFirstRow, rows));
+		int lastRow = std::max(firstRow, std::min(wrapLastRow, rows));
+
+		int offset = (cols > 0) ? wrapOffset % cols : 0;
+		if (offset < 0) offset += cols;
+
+		if (offset == 0 || firstRow == lastRow)
+		{
+			painter.drawImage(QPoint(0, 0), qImage);
+		}
+		else
+		{
+			int numRows = lastRow - firstRow;
+
+			painter.drawImage(QPoint(0, 0), qImage, QRect(0, 0, cols, firstRow));
+			painter.drawImage(QPoint(offset, firstRow), qImage, QRect(0, firstRow, cols - offset, numRows));
+			painter.drawImage(QPoint(0, firstRow), qImage, QRect(cols - offset, firstRow, offset, numRows));
+			painter.drawImage(QPoint(0, lastRow), qImage, QRect(0, lastRow, cols, rows - lastRow));
+		}
+
+		if (crosshairLength > 0 && !qImage.isNull())
+		{
+			int centerX = cols / 2;
+			int centerY = rows / 2;
+
+			painter.setPen(QPen(crosshairColor, crosshairThickness));
+			painter.drawLine(centerX, centerY - crosshairLength, centerX, centerY + crosshairLength);
+			painter.drawLine(centerX - crosshairLength, centerY, centerX + crosshairLength, centerY);
+		}
+
 		painter.end();
 	}
 
 	cv::Mat mat;
 	QImage qImage;
+
+	int wrapOffset;
+	int wrapFirstRow;
+	int wrapLastRow;
+
+	int crosshairLength;
+	int crosshairThickness;
+	QColor crosshairColor;
 };
\ No newline at end of file
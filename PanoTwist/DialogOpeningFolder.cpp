@@ -21,10 +21,106 @@
 */
 
 #include "DialogOpeningFolder.h"
+#include "PanoProcessing.h"
+#include "FolderIndex.h"
+
 #include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <chrono>
+#include <condition_variable>
+#include <vector>
+
+namespace
+{
+	//The scan is limited by the latency of the file system on network shares rather than by the cores,
+	//so there are at least this many scanning threads
+	const int minScanThreads = 8;
+
+	//The interface is updated at most this often, with the last file merged
+	const int progressIntervalMs = 50;
+
+	//The result of checking a single file
+	struct ScanResult
+	{
+		ScanResult() : fDone(false), fFromIndex(false), fDecoded(false), probeMs(0) {}
+
+		bool fDone;
+		bool fFromIndex;			//The file has not changed since the last scan
+		bool fDecoded;				//The headers were not enough, the image was decoded
+		double probeMs;
+		FolderIndex::Entry entry;
+		cv::Mat thumbnail;			//Only for probed files, thumbnail-sized; files from the index have the encoded thumbnail in the entry
+	};
+
+	//Classifies the file as an equirectangular panorama (width == height * 2) and fills the size and the thumbnail
+	//The size and the GPano projection type are read from the headers,
+	//the image is only decoded if the headers don't have the size
+	//A decoded image is shrunk to thumbnail size here, so the results waiting to be merged never hold a full decode
+	//Returns true if the image had to be decoded
+	bool ProbeFile(const BString& fullFileName, FolderIndex::Entry& entry, cv::Mat& thumbnail)
+	{
+		ImageHeader header;
+		bool fHeader = PanoProcessing::ReadImageHeader(fullFileName, header, true);
+		bool fDecoded = false;
+
+		if (fHeader && !header.projectionType.IsEmpty() && header.projectionType != "equirectangular")
+		{
+			entry.fPanorama = false;
+		}
+		else
+		{
+			if (!fHeader || header.width <= 0 || header.height <= 0)
+			{
+				cv::Mat mat = cv::imread(fullFileName, CV_LOAD_IMAGE_COLOR);
+				header.width = mat.cols;
+				header.height = mat.rows;
+				header.thumbnail = mat;
+				fDecoded = true;
+			}
+
+			entry.fPanorama = PanoProcessing::IsEquirectangular(header.width, header.height);
+		}
+
+		entry.width = header.width;
+		entry.height = header.height;
+		thumbnail = FolderIndex::ShrinkThumbnail(header.thumbnail);
+		FolderIndex::EncodeThumbnail(thumbnail, entry.thumbnail);
+
+		return fDecoded;
+	}
+
+	//Takes the file from the index if its size and modification time have not changed, probes it otherwise
+	void ScanFile(const BString& folder, const BString& nameOnly, const FolderIndex& oldIndex, ScanResult& result)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		QFileInfo info((folder + nameOnly).c_str());
+		int64 fileSize = info.size();
+		int64 modifiedMs = info.lastModified().toMSecsSinceEpoch();
+
+		const FolderIndex::Entry* cached = oldIndex.Find(nameOnly);
+		if (cached && cached->fileSize == fileSize && cached->modifiedMs == modifiedMs)
+		{
+			result.entry = *cached;
+			result.fFromIndex = true;
+		}
+		else
+		{
+			result.entry.name = nameOnly;
+			result.entry.fileSize = fileSize;
+			result.entry.modifiedMs = modifiedMs;
+			result.fDecoded = ProbeFile(folder + nameOnly, result.entry, result.thumbnail);
+		}
+
+		result.probeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+}
 
 DialogOpeningFolder::DialogOpeningFolder(QWidget* parent, const BString& theFolder, CHArray<BString>& outNameOnlyArray) :
-DialogSaveOrOpen(parent, theFolder, outNameOnlyArray)
+DialogSaveOrOpen(parent, theFolder, outNameOnlyArray),
+lastProbeMs(0),
+lastProbeSource(ProbedHeader)
 {
 	//No need to setup Ui, it's already set up in the base class
 
@@ -63,10 +159,15 @@ void DialogOpeningFolder::OnFileFinished()
 	ui.progressBar->setValue(std::round(percentDone));
 
 	BString info;
-	info.Format("Opened %s. %i panoramas found.", lastImageName, fileList.Count());
+	const char* source = "";
+	if (lastProbeSource == ProbedDecoded) source = " (decoded)";
+	else if (lastProbeSource == FromIndex) source = " (from index)";
+
+	info.Format("Checked %s in %.1f ms%s. %i panoramas found.", lastImageName.c_str(), lastProbeMs, source, fileList.Count());
 	ui.labelCurFile->setText(info.c_str());
 
-	imageWidget->RescaleToParentAndShow(lastImage);
+	//Files without an embedded preview are not shown
+	if (!lastImage.empty()) imageWidget->RescaleToParentAndShow(lastImage);
 }
 
 void DialogOpeningFolder::WorkerThread()
@@ -82,31 +183,130 @@ void DialogOpeningFolder::WorkerThread()
 	//Read the list of files in the directory
 	QStringList dirList = dir.entryList();
 	
-	//Check each file and store file names into the array
-	//For equirectangular panoramas (width == height * 2)
-	int numFilesRead = 0;
-	for (auto& fileName : dirList)
+	//Plain copies of the names, the Qt list is not shared with the scanning threads
+	CHArray<BString> names;
+	for (auto& fileName : dirList) names << BString(fileName.toStdString());
+	int numFiles = names.Count();
+
+	//Files that have not changed since the last scan of the folder are taken from its index
+	FolderIndex oldIndex, newIndex;
+	oldIndex.LoadFolder(folder);
+	bool fIndexChanged = false;
+
+	//Each scanning thread takes the next file from the list
+	std::vector<ScanResult> results(numFiles);
+	std::mutex resultMutex;
+	std::condition_variable resultReady;
+	std::atomic<int> nextIndex(0);
+	int numDone = 0;		//Guarded by resultMutex
+
+	int numThreads = std::min(numFiles, std::max(minScanThreads, int(std::thread::hardware_concurrency())));
+	std::vector<std::thread> threads;
+	for (int t = 0; t < numThreads; t++)
 	{
-		BString fullFileName = folder + fileName.toStdString().c_str();
-		cv::Mat mat = cv::imread(fullFileName, CV_LOAD_IMAGE_COLOR);
-		numFilesRead++;
+		threads.push_back(std::thread([&]()
+		{
+			int i;
+			while (!fCloseRequested && (i = nextIndex++) < numFiles)
+			{
+				ScanResult result;
+				ScanFile(folder, names[i], oldIndex, result);
+
+				std::lock_guard<std::mutex> lock(resultMutex);
+				results[i] = result;
+				results[i].fDone = true;
+				numDone++;
+				resultReady.notify_one();
+			}
+		}));
+	}
+
+	//Results are merged in the order of the directory listing, so the list of panoramas does not depend on
+	//which thread finished first; the interface is updated once per progressIntervalMs, not for every file
+	int numMerged = 0;
+	while (numMerged < numFiles && !fCloseRequested)
+	{
+		int numReady = numMerged;
+		if (1)
+		{
+			std::unique_lock<std::mutex> lock(resultMutex);
+			resultReady.wait_for(lock, std::chrono::milliseconds(progressIntervalMs),
+				[&]{ return fCloseRequested || numDone == numFiles; });
+
+			while (numReady < numFiles && results[numReady].fDone) numReady++;
+		}
+
+		if (numReady == numMerged) continue;
+
+		CHArray<BString> newPanoramas;
+		cv::Mat thumbnail;
+		int thumbnailIndex = -1;
+
+		for (int i = numMerged; i < numReady; i++)
+		{
+			ScanResult& result = results[i];
+			newIndex.Add(result.entry);
+			if (!result.fFromIndex) fIndexChanged = true;
+			if (result.entry.fPanorama) newPanoramas << names[i];
+
+			//The thumbnail of the last file in the batch that has one
+			if (!result.thumbnail.empty())
+			{
+				thumbnail = result.thumbnail;
+				thumbnailIndex = -1;
+			}
+			else if (!result.entry.thumbnail.IsEmpty())
+			{
+				thumbnail.release();
+				thumbnailIndex = i;
+			}
+			result.thumbnail.release();		//Only the shown one is kept
+		}
+
+		//Only the thumbnail that is going to be shown is decoded
+		if (thumbnail.empty() && thumbnailIndex >= 0) thumbnail = FolderIndex::DecodeThumbnail(results[thumbnailIndex].entry.thumbnail);
+
+		const ScanResult& last = results[numReady - 1];
+		numMerged = numReady;
 
 		if(1)		//So that the compiler does not try to optimize out the block
 		{
 			//This block is guarded by a mutex
 			std::lock_guard<std::recursive_mutex> lock(mutex);
 
-			percentDone = 100.0 * double(numFilesRead) / double(dirList.count());
-			lastImageName = fileName.toStdString();
-			mat.copyTo(lastImage);
+			percentDone = 100.0 * double(numMerged) / double(numFiles);
+			lastImageName = names[numMerged - 1];
+			lastImage = thumbnail;		//Not touched by the worker after this, no need for a deep copy
+			lastProbeMs = last.probeMs;
+			lastProbeSource = last.fFromIndex ? FromIndex : (last.fDecoded ? ProbedDecoded : ProbedHeader);
 
-			if (mat.size().width > 0 && mat.size().height > 0 && mat.size().width == mat.size().height * 2) fileList << fileName.toStdString();
+			fileList << newPanoramas;
 
 			emit SignalFileFinished();
 		}
+	}
+
+	for (auto& thread : threads) thread.join();
 
-		if (fCloseRequested) break;
+	//If the scan was cancelled, keep what was scanned out of order and the old entries of the files it did not get to
+	for (int i = numMerged; i < numFiles; i++)
+	{
+		if (results[i].fDone)
+		{
+			newIndex.Add(results[i].entry);
+			if (!results[i].fFromIndex) fIndexChanged = true;
+			continue;
+		}
+
+		const FolderIndex::Entry* cached = oldIndex.Find(names[i]);
+		if (cached) newIndex.Add(*cached);
 	}
 
+	//Files that were deleted since the last scan also change the index
+	if (newIndex.Count() != oldIndex.Count()) fIndexChanged = true;
+
+	//The folder may be read-only, the index is just not saved then
+	if (fIndexChanged) newIndex.SaveFolder(folder);
+
 	emit SignalThreadFinished();
 }
\ No newline at end of file
@@ -40,4 +40,12 @@ public slots:
 protected:
 	//Redefine the worker thread from base class
 	void WorkerThread();
+
+protected:
+	//How the last file was classified
+	enum ProbeSource { ProbedHeader, ProbedDecoded, FromIndex };
+
+	//Guarded by the mutex, like the members of the base class
+	double lastProbeMs;				//Time it took to classify the last file
+	ProbeSource lastProbeSource;
 };
\ No newline at end of file
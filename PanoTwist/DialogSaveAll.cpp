@@ -29,11 +29,16 @@ DialogSaveAll::DialogSaveAll(
 							CHArray<BString>& theFileList,
 							const BString& theSaveSubfolder,
 							std::function<void(cv::Mat&)> theProcessingFunction,
-							std::function<void(const BString&, const cv::Mat&)> theExifTagFunction) :
+							BatchPipeline::TagFunction theExifTagFunction,
+							const BatchPipeline::Config& thePipelineConfig,
+							BatchPipeline::DirectFunction theDirectFunction) :
 DialogSaveOrOpen(parent, theFolder, theFileList),
 saveSubfolder(theSaveSubfolder),
 processingFunction(theProcessingFunction),
-exifTagFunction(theExifTagFunction)
+exifTagFunction(theExifTagFunction),
+pipelineConfig(thePipelineConfig),
+directFunction(theDirectFunction),
+numFilesFinished(0)
 {
 	//No need to setup Ui, it's already set up in the base class
 
@@ -73,40 +78,51 @@ void DialogSaveAll::OnFileFinished()
 	info.Format("Saved file %s (%i files processed).", lastImageName, numImagesProcessed);
 	ui.labelCurFile->setText(info.c_str());
 
-	imageWidget->RescaleToParentAndShow(lastImage);
+	//Files that failed to load are reported too, so there may be no image yet
+	if (!lastImage.empty()) imageWidget->RescaleToParentAndShow(lastImage);
 }
 
+//Files are saved by a BatchPipeline, so reading, processing, writing and tagging of different files overlap
+//Files are reported in the order in which they finish, which may differ from the order of the list
 void DialogSaveAll::WorkerThread()
 {
 	//Folder where the results are going to be saved
 	BString resultsFolder = folder + saveSubfolder;
 
-	//For each file name in the list
+	CHArray<BString> inFiles, outFiles;
 	for (auto& name : fileList)
 	{
-		//Read matrix, process it, save it to the subfolder, set exif tags
-		cv::Mat mat = cv::imread(folder + name, CV_LOAD_IMAGE_COLOR);
-
-		if (mat.cols == 0 || mat.rows == 0) continue;	//Something went wrong - maybe the user moved the file
-
-		processingFunction(mat);
-		cv::imwrite(resultsFolder + name, mat);
-		exifTagFunction(resultsFolder + name, mat);
+		inFiles << folder + name;
+		outFiles << resultsFolder + name;
+	}
 
-		numImagesProcessed++;
+	BatchPipeline pipeline(pipelineConfig,
+		[this](cv::Mat& mat) -> bool { processingFunction(mat); return true; },
+		exifTagFunction);
+	pipeline.SetDirectFunction(directFunction);
 
+	pipeline.Run(inFiles, outFiles, fCloseRequested,
+		[this](int index, BatchPipeline::FileStatus status, const cv::Mat& mat)
+	{
 		if (1)
 		{
 			//This block is guarded by a mutex
 			std::lock_guard<std::recursive_mutex> lock(mutex);
-			percentDone = 100.0 * double(numImagesProcessed) / double(fileList.Count());
-			lastImageName = name;
-			mat.copyTo(lastImage);
+
+			numFilesFinished++;
+			percentDone = 100.0 * double(numFilesFinished) / double(fileList.Count());
+
+			//The file is written even if the tags could not be inserted
+			if (status == BatchPipeline::Saved || status == BatchPipeline::TagFailed)
+			{
+				numImagesProcessed++;
+				lastImageName = fileList[index];
+				lastImage = mat;	//The pipeline does not touch the image after this call, no need for a deep copy
+			}
 		}
 
 		emit SignalFileFinished();
-		if (fCloseRequested) break;
-	}
+	});
 	
 	emit SignalThreadFinished();	
 }
\ No newline at end of file
@@ -23,6 +23,7 @@
 #pragma once
 
 #include "DialogSaveOrOpen.h"
+#include "BatchPipeline.h"
 
 #include <functional>
 
@@ -36,8 +37,10 @@ public:
 		const BString& theFolder,
 		CHArray<BString>& theFileList,
 		const BString& theSaveSubfolder,
-		std::function<void(cv::Mat&)> theProcessingFunction,							//function that processes the image
-		std::function<void(const BString&, const cv::Mat&)> theExifTagFunction);		//function that inserts panorama exif tags when given the file name
+		std::function<void(cv::Mat&)> theProcessingFunction,							//function that processes the image, called from several threads at once
+		BatchPipeline::TagFunction theExifTagFunction,									//function that inserts panorama exif tags into the encoded file
+		const BatchPipeline::Config& thePipelineConfig = BatchPipeline::DefaultConfig(),	//worker threads for each stage of saving
+		BatchPipeline::DirectFunction theDirectFunction = nullptr);						//saves files that don't need decoding
 	~DialogSaveAll(){}
 
 public slots:
@@ -52,5 +55,9 @@ protected:
 private:
 	BString saveSubfolder;
 	std::function<void(cv::Mat&)> processingFunction;
-	std::function<void(const BString&, const cv::Mat&)> exifTagFunction;
+	BatchPipeline::TagFunction exifTagFunction;
+	BatchPipeline::Config pipelineConfig;
+	BatchPipeline::DirectFunction directFunction;
+
+	int numFilesFinished;	//Saved or failed, guarded by the mutex
 };
\ No newline at end of file
@@ -0,0 +1,197 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+
+#include "FolderIndex.h"
+
+#include <fstream>
+#include <cstdio>
+
+namespace
+{
+	const BString indexFileName = ".panotwist-index";
+
+	//Written at the start of the file, the index is discarded if either does not match
+	const int indexMagic = 0x58444950;		//"PIDX"
+	const int indexVersion = 1;
+
+	const int maxThumbnailWidth = 256;
+	const int thumbnailQuality = 80;
+
+	//Counts read from the index are checked against these before anything is allocated
+	const int maxEntries = 1 << 20;
+	const int maxNameLength = 4096;
+	const int maxThumbnailBytes = 1 << 22;
+
+	//Reads a count and fails the archive if it can't be read or is out of range
+	int ReadCount(BArchive& ar, int maxCount)
+	{
+		int count = -1;
+		ar >> count;
+		if (!ar.IsGood() || count < 0 || count > maxCount)
+		{
+			ar.SetFailed();
+			return 0;
+		}
+		return count;
+	}
+}
+
+//Loading reads the same layout as BString and CHArray store, but with limited lengths
+void FolderIndex::Entry::Serialize(BArchive& ar)
+{
+	if (ar.IsStoring())
+	{
+		ar & name & fileSize & modifiedMs & width & height & fPanorama & thumbnail;
+		return;
+	}
+
+	int nameLength = ReadCount(ar, maxNameLength);
+	name.assign(size_t(nameLength), 0);
+	if (nameLength > 0) ar.RetrieveArray(&name[0], nameLength);
+
+	ar & fileSize & modifiedMs & width & height & fPanorama;
+
+	int thumbnailBytes = ReadCount(ar, maxThumbnailBytes);
+	thumbnail.ResizeArray(thumbnailBytes, true);
+	if (thumbnailBytes > 0) ar.RetrieveArray(thumbnail.arr, thumbnailBytes);
+}
+
+void FolderIndex::Serialize(BArchive& ar)
+{
+	//An empty or foreign file leaves magic at 0
+	int magic = ar.IsStoring() ? indexMagic : 0;
+	int version = ar.IsStoring() ? indexVersion : 0;
+	ar & magic & version;
+
+	if (ar.IsLoading() && (magic != indexMagic || version != indexVersion))
+	{
+		entries.ResizeArray(0);
+		return;
+	}
+
+	if (ar.IsStoring())
+	{
+		ar & entries;
+		return;
+	}
+
+	//A truncated or corrupt index is thrown away as a whole
+	int count = ReadCount(ar, maxEntries);
+	entries.ResizeArray(count, true);
+	for (int i = 0; i < count && ar.IsGood(); i++) entries[i].Serialize(ar);
+	if (!ar.IsGood()) entries.ResizeArray(0);
+}
+
+bool FolderIndex::LoadFolder(const BString& folder)
+{
+	entries.ResizeArray(0);
+	lookup.clear();
+
+	//A missing index is not an error, Savable::Load() would complain about it
+	BString fileName = folder + indexFileName;
+	if (!std::ifstream(fileName, std::ifstream::binary)) return false;
+
+	if (!Load(fileName)) return false;
+
+	BuildLookup();
+	return entries.Count() > 0;
+}
+
+//Written to a temporary file first, so that an interrupted save does not leave a truncated index behind
+bool FolderIndex::SaveFolder(const BString& folder)
+{
+	BString fileName = folder + indexFileName;
+	BString tempFileName = fileName + ".tmp";
+
+	//Save() fails on write errors too, the old index is then kept
+	if (!Save(tempFileName))
+	{
+		std::remove(tempFileName.c_str());
+		return false;
+	}
+
+	std::remove(fileName.c_str());
+	if (std::rename(tempFileName.c_str(), fileName.c_str()) != 0)
+	{
+		std::remove(tempFileName.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+const FolderIndex::Entry* FolderIndex::Find(const BString& name) const
+{
+	auto it = lookup.find(name);
+	if (it == lookup.end()) return nullptr;
+	return &entries[it->second];
+}
+
+void FolderIndex::Add(const Entry& entry)
+{
+	auto it = lookup.find(entry.name);
+	if (it != lookup.end())
+	{
+		entries[it->second] = entry;
+		return;
+	}
+
+	lookup[entry.name] = entries.Count();
+	entries << entry;
+}
+
+void FolderIndex::BuildLookup()
+{
+	lookup.clear();
+	for (int i = 0; i < entries.Count(); i++) lookup[entries[i].name] = i;
+}
+
+cv::Mat FolderIndex::ShrinkThumbnail(const cv::Mat& image)
+{
+	if (image.cols <= maxThumbnailWidth) return image;
+
+	cv::Mat small;
+	int height = std::max(1, image.rows * maxThumbnailWidth / image.cols);
+	cv::resize(image, small, cv::Size(maxThumbnailWidth, height), 0, 0, cv::INTER_AREA);
+	return small;
+}
+
+void FolderIndex::EncodeThumbnail(const cv::Mat& image, CHArray<uchar>& data)
+{
+	data.ResizeArray(0);
+	if (image.empty()) return;
+
+	cv::Mat small = ShrinkThumbnail(image);
+
+	std::vector<uchar> buffer;
+	std::vector<int> params = { cv::IMWRITE_JPEG_QUALITY, thumbnailQuality };
+	if (!cv::imencode(".jpg", small, buffer, params)) return;
+
+	data.CopyFromPointer(buffer.data(), int(buffer.size()));
+}
+
+cv::Mat FolderIndex::DecodeThumbnail(const CHArray<uchar>& data)
+{
+	if (data.IsEmpty()) return cv::Mat();
+	return cv::imdecode(cv::Mat(1, data.Count(), CV_8UC1, data.arr), CV_LOAD_IMAGE_COLOR);
+}
@@ -0,0 +1,84 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+
+//Per-folder index of the panorama scan done by DialogOpeningFolder
+//Stored in the folder itself through Savable/BArchive, so that reopening a folder
+//only has to stat the files and probe the ones that are new or have changed
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include "Array.h"
+
+#include <map>
+
+class FolderIndex : public Savable
+{
+public:
+	//What the scan found out about a single file
+	struct Entry
+	{
+		Entry() : fileSize(0), modifiedMs(0), width(0), height(0), fPanorama(false) {}
+
+		void Serialize(BArchive& ar);
+
+		BString name;				//File name without the folder
+		int64 fileSize;				//Size and modification time (ms since epoch) the entry is valid for
+		int64 modifiedMs;
+		int width;					//Size of the image, 0 if unknown
+		int height;
+		bool fPanorama;				//Equirectangular panorama
+		CHArray<uchar> thumbnail;	//JPEG-encoded preview, empty if there is none
+	};
+
+public:
+	FolderIndex(){}
+	~FolderIndex(){}
+
+	void Serialize(BArchive& ar);
+
+	//Loads the index file of the folder; returns false and leaves the index empty
+	//if there is no index file or it was written by a different version
+	bool LoadFolder(const BString& folder);
+
+	//Writes the index file of the folder, returns false if the folder is not writable
+	bool SaveFolder(const BString& folder);
+
+	//Returns nullptr if the file is not in the index
+	//The caller still has to check the size and modification time of the entry
+	const Entry* Find(const BString& name) const;
+
+	void Add(const Entry& entry);
+	int Count() const { return entries.Count(); }
+
+	//Thumbnails are downscaled and stored as JPEG to keep the index file small
+	static cv::Mat ShrinkThumbnail(const cv::Mat& image);		//The downscaled image that EncodeThumbnail() stores
+	static void EncodeThumbnail(const cv::Mat& image, CHArray<uchar>& data);
+	static cv::Mat DecodeThumbnail(const CHArray<uchar>& data);
+
+private:
+	void BuildLookup();
+
+private:
+	CHArray<Entry> entries;
+	std::map<BString, int> lookup;		//Entry position by file name
+};
@@ -0,0 +1,56 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+
+//libjpeg error handling for JpegLossless and JpegStream
+//libjpeg calls error_exit on errors and expects it not to return, so it jumps back to a setjmp() in the caller:
+//	JpegErrorManager err;
+//	InitJpegErrorManager(err);
+//	cinfo.err = &err.pub;
+//	if (setjmp(err.jump)) { ...destroy cinfo, return failure... }
+#pragma once
+
+#include <cstdio>
+#include <csetjmp>
+
+#include <jpeglib.h>
+
+struct JpegErrorManager
+{
+	jpeg_error_mgr pub;
+	jmp_buf jump;
+};
+
+inline void JpegErrorExit(j_common_ptr cinfo)
+{
+	longjmp(reinterpret_cast<JpegErrorManager*>(cinfo->err)->jump, 1);
+}
+
+//No warnings on stderr
+inline void JpegOutputMessage(j_common_ptr) {}
+
+inline void InitJpegErrorManager(JpegErrorManager& err)
+{
+	jpeg_std_error(&err.pub);
+	err.pub.error_exit = JpegErrorExit;
+	err.pub.output_message = JpegOutputMessage;
+}
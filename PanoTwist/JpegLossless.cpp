@@ -0,0 +1,632 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+
+#include "JpegLossless.h"
+#include "JpegScan.h"
+#include "JpegErrorManager.h"
+
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+namespace
+{
+	//Compresses into a std::vector; libjpeg before version 8 has no jpeg_mem_dest()
+	struct VectorDestination
+	{
+		jpeg_destination_mgr pub;
+		std::vector<uchar>* data;
+	};
+
+	void InitDestination(j_compress_ptr cinfo)
+	{
+		VectorDestination* dest = reinterpret_cast<VectorDestination*>(cinfo->dest);
+		dest->data->resize(65536);
+		dest->pub.next_output_byte = dest->data->data();
+		dest->pub.free_in_buffer = dest->data->size();
+	}
+
+	//Called when the whole buffer is full
+	boolean EmptyOutputBuffer(j_compress_ptr cinfo)
+	{
+		VectorDestination* dest = reinterpret_cast<VectorDestination*>(cinfo->dest);
+		size_t used = dest->data->size();
+		dest->data->resize(used * 2);
+		dest->pub.next_output_byte = dest->data->data() + used;
+		dest->pub.free_in_buffer = used;
+		return TRUE;
+	}
+
+	void TermDestination(j_compress_ptr cinfo)
+	{
+		VectorDestination* dest = reinterpret_cast<VectorDestination*>(cinfo->dest);
+		dest->data->resize(dest->data->size() - dest->pub.free_in_buffer);
+	}
+
+	void SetVectorDestination(jpeg_compress_struct& cinfo, VectorDestination& dest, std::vector<uchar>& data)
+	{
+		dest.data = &data;
+		dest.pub.init_destination = InitDestination;
+		dest.pub.empty_output_buffer = EmptyOutputBuffer;
+		dest.pub.term_destination = TermDestination;
+		cinfo.dest = &dest.pub;
+	}
+
+	//Decompresses from memory; all data is in the buffer from the start
+	void InitSource(j_decompress_ptr) {}
+	void TermSource(j_decompress_ptr) {}
+
+	//Only called past the end of the data, which is a corrupt file - ends it with an EOI marker
+	boolean FillInputBuffer(j_decompress_ptr cinfo)
+	{
+		static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+		cinfo->src->next_input_byte = eoi;
+		cinfo->src->bytes_in_buffer = 2;
+		return TRUE;
+	}
+
+	void SkipInputData(j_decompress_ptr cinfo, long numBytes)
+	{
+		if (numBytes <= 0) return;
+		if (size_t(numBytes) > cinfo->src->bytes_in_buffer) numBytes = long(cinfo->src->bytes_in_buffer);
+		cinfo->src->next_input_byte += numBytes;
+		cinfo->src->bytes_in_buffer -= numBytes;
+	}
+
+	void SetMemorySource(jpeg_decompress_struct& cinfo, jpeg_source_mgr& src, const std::vector<uchar>& data)
+	{
+		src.init_source = InitSource;
+		src.fill_input_buffer = FillInputBuffer;
+		src.skip_input_data = SkipInputData;
+		src.resync_to_restart = jpeg_resync_to_restart;
+		src.term_source = TermSource;
+		src.next_input_byte = data.data();
+		src.bytes_in_buffer = data.size();
+		cinfo.src = &src;
+	}
+
+	//Width of an MCU column in pixels, 0 if the image width is not a whole number of them
+	//The last column would be padded, and padding can't be moved into the middle of the image
+	int McuWidth(const jpeg_decompress_struct& cinfo)
+	{
+		int mcuWidth = cinfo.max_h_samp_factor * DCTSIZE;
+		if (cinfo.image_width == 0 || cinfo.image_width % mcuWidth != 0) return 0;
+		return mcuWidth;
+	}
+
+	//Shift of a component in blocks for a shift of the image by numPixels, in [0, widthInBlocks)
+	int BlockShift(const jpeg_decompress_struct& cinfo, const jpeg_component_info& comp, int numPixels)
+	{
+		int mcuWidth = cinfo.max_h_samp_factor * DCTSIZE;
+		int widthInBlocks = int(comp.width_in_blocks);
+
+		int shift = (numPixels / mcuWidth * comp.h_samp_factor) % widthInBlocks;
+		if (shift < 0) shift += widthInBlocks;
+		return shift;
+	}
+
+	//Same as HorizontalCyclicRotate(), on a row of DCT blocks
+	void ShiftBlockRow(JBLOCKROW row, int widthInBlocks, int shift, std::vector<JCOEF>& scratch)
+	{
+		if (shift == 0) return;
+
+		int restBlocks = widthInBlocks - shift;
+		scratch.resize(shift * DCTSIZE2);
+
+		memcpy(scratch.data(), row + restBlocks, shift * sizeof(JBLOCK));
+		memmove(row + shift, row, restBlocks * sizeof(JBLOCK));
+		memcpy(row, scratch.data(), shift * sizeof(JBLOCK));
+	}
+
+	//Calls func(blockRow, comp, row) for every row of blocks of every component
+	//The virtual arrays can only be accessed v_samp_factor rows at a time
+	template<class Func>
+	void ForEachBlockRow(jpeg_decompress_struct& cinfo, jvirt_barray_ptr* coefArrays, bool fWritable, Func func)
+	{
+		for (int c = 0; c < cinfo.num_components; c++)
+		{
+			jpeg_component_info& comp = cinfo.comp_info[c];
+
+			for (JDIMENSION y = 0; y < comp.height_in_blocks; y += comp.v_samp_factor)
+			{
+				JBLOCKARRAY rows = (*cinfo.mem->access_virt_barray)((j_common_ptr)&cinfo, coefArrays[c],
+					y, JDIMENSION(comp.v_samp_factor), fWritable ? TRUE : FALSE);
+
+				for (int k = 0; k < comp.v_samp_factor && y + k < comp.height_in_blocks; k++)
+				{
+					func(rows[k], c, int(y) + k);
+				}
+			}
+		}
+	}
+
+	//Sampling and quantization of a file read by libjpeg
+	JpegLayout LayoutOf(const jpeg_decompress_struct& cinfo)
+	{
+		JpegLayout layout;
+		layout.width = int(cinfo.image_width);
+		layout.height = int(cinfo.image_height);
+		layout.numComponents = cinfo.num_components;
+		layout.maxH = cinfo.max_h_samp_factor;
+		layout.maxV = cinfo.max_v_samp_factor;
+
+		for (int c = 0; c < cinfo.num_components; c++)
+		{
+			const jpeg_component_info& comp = cinfo.comp_info[c];
+			layout.h[c] = comp.h_samp_factor;
+			layout.v[c] = comp.v_samp_factor;
+			for (int k = 0; k < DCTSIZE2; k++) layout.quant[c][k] = comp.quant_table->quantval[k];
+		}
+
+		return layout;
+	}
+
+	//Copies the MCU rows of blocks from or into libjpeg's virtual arrays, which have the same padding
+	void CopyMcuRows(j_common_ptr cinfo, jvirt_barray_ptr* arrays, int firstMcuRow, const JpegLayout& layout,
+		McuRowBlocks& blocks, bool fToArrays)
+	{
+		static_assert(sizeof(JCOEF) == sizeof(short), "McuRowBlocks holds libjpeg coefficients");
+
+		for (int c = 0; c < layout.numComponents; c++)
+		{
+			int firstRow = (blocks.FirstMcuRow() - firstMcuRow) * layout.v[c];
+			size_t rowBytes = blocks.BlockCols(c) * sizeof(JBLOCK);
+
+			for (int y = 0; y < blocks.BlockRows(c); y++)
+			{
+				JBLOCKARRAY rows = (*cinfo->mem->access_virt_barray)(cinfo, arrays[c], JDIMENSION(firstRow + y), 1, fToArrays ? TRUE : FALSE);
+				if (fToArrays) memcpy(rows[0], blocks.Block(c, y, 0), rowBytes);
+				else memcpy(blocks.Block(c, y, 0), rows[0], rowBytes);
+			}
+		}
+	}
+
+	//Sets up compression of an RGB image of the given height with the sampling and quantization tables of layout
+	void SetupLike(jpeg_compress_struct& info, const JpegLayout& layout, int height)
+	{
+		info.image_width = JDIMENSION(layout.width);
+		info.image_height = JDIMENSION(height);
+		info.input_components = 3;
+		info.in_color_space = JCS_RGB;
+		jpeg_set_defaults(&info);
+
+		//Each component gets its own copy of the table it was quantized with
+		for (int c = 0; c < layout.numComponents; c++)
+		{
+			jpeg_component_info& comp = info.comp_info[c];
+			comp.h_samp_factor = layout.h[c];
+			comp.v_samp_factor = layout.v[c];
+			comp.quant_tbl_no = c;
+
+			if (!info.quant_tbl_ptrs[c]) info.quant_tbl_ptrs[c] = jpeg_alloc_quant_table((j_common_ptr)&info);
+			for (int k = 0; k < DCTSIZE2; k++) info.quant_tbl_ptrs[c]->quantval[k] = layout.quant[c][k];
+		}
+	}
+
+	//Writes the blocks into a JPEG file in memory, without decoding them
+	bool WriteMcuRows(const JpegLayout& layout, McuRowBlocks& blocks, std::vector<uchar>& data)
+	{
+		jpeg_compress_struct info;
+		JpegErrorManager err;
+		InitJpegErrorManager(err);
+		info.err = &err.pub;
+		jpeg_create_compress(&info);
+
+		VectorDestination dest;
+		SetVectorDestination(info, dest, data);
+
+		if (setjmp(err.jump))
+		{
+			jpeg_destroy_compress(&info);
+			return false;
+		}
+
+		int mcuHeight = layout.McuHeight();
+		SetupLike(info, layout, std::min(blocks.LastMcuRow() * mcuHeight, layout.height) - blocks.FirstMcuRow() * mcuHeight);
+
+		//The arrays are realized by jpeg_write_coefficients(), but only read by jpeg_finish_compress()
+		jvirt_barray_ptr arrays[MAX_COMPONENTS];
+		for (int c = 0; c < layout.numComponents; c++)
+		{
+			arrays[c] = (*info.mem->request_virt_barray)((j_common_ptr)&info, JPOOL_IMAGE, FALSE,
+				JDIMENSION(blocks.BlockCols(c)), JDIMENSION(blocks.BlockRows(c)), JDIMENSION(layout.v[c]));
+		}
+
+		jpeg_write_coefficients(&info, arrays);
+		CopyMcuRows((j_common_ptr)&info, arrays, blocks.FirstMcuRow(), layout, blocks, true);
+
+		jpeg_finish_compress(&info);
+		jpeg_destroy_compress(&info);
+		return true;
+	}
+
+	//Encodes an RGB image into a JPEG file in memory, with the sampling and quantization tables of layout
+	bool EncodeLike(const JpegLayout& layout, const cv::Mat& rgb, std::vector<uchar>& data)
+	{
+		jpeg_compress_struct info;
+		JpegErrorManager err;
+		InitJpegErrorManager(err);
+		info.err = &err.pub;
+		jpeg_create_compress(&info);
+
+		VectorDestination dest;
+		SetVectorDestination(info, dest, data);
+
+		if (setjmp(err.jump))
+		{
+			jpeg_destroy_compress(&info);
+			return false;
+		}
+
+		SetupLike(info, layout, rgb.rows);
+		jpeg_start_compress(&info, TRUE);
+
+		while (info.next_scanline < info.image_height)
+		{
+			JSAMPROW row = const_cast<JSAMPROW>(rgb.ptr(int(info.next_scanline)));
+			jpeg_write_scanlines(&info, &row, 1);
+		}
+
+		jpeg_finish_compress(&info);
+		jpeg_destroy_compress(&info);
+		return true;
+	}
+
+	//Replaces the blocks with those of the JPEG file in data
+	bool ReadMcuRows(const JpegLayout& layout, const std::vector<uchar>& data, McuRowBlocks& blocks)
+	{
+		jpeg_decompress_struct info;
+		JpegErrorManager err;
+		InitJpegErrorManager(err);
+		info.err = &err.pub;
+		jpeg_create_decompress(&info);
+
+		if (setjmp(err.jump))
+		{
+			jpeg_destroy_decompress(&info);
+			return false;
+		}
+
+		jpeg_source_mgr src;
+		SetMemorySource(info, src, data);
+		jpeg_read_header(&info, TRUE);
+		jvirt_barray_ptr* arrays = jpeg_read_coefficients(&info);
+
+		CopyMcuRows((j_common_ptr)&info, arrays, blocks.FirstMcuRow(), layout, blocks, false);
+
+		jpeg_finish_decompress(&info);
+		jpeg_destroy_decompress(&info);
+		return true;
+	}
+
+	//MCU rows [first, last) that intersect the nadir and zenith bands
+	//If the bands come close enough to share an MCU row, the whole image is one strip
+	std::vector<std::pair<int, int>> PatchStrips(const JpegLayout& layout, const PatchSettings& nadir, const PatchSettings& zenith)
+	{
+		int mcuHeight = layout.McuHeight();
+
+		std::vector<std::pair<int, int>> strips;
+		const PatchSettings* settings[2] = { &nadir, &zenith };
+		for (int k = 0; k < 2; k++)
+		{
+			int bandRows = PanoProcessing::PatchHeight(*settings[k], layout.height);
+			if (bandRows == 0) continue;
+
+			int firstRow = settings[k]->fNadir ? layout.height - bandRows : 0;
+			int lastRow = firstRow + bandRows;
+			std::pair<int, int> strip(firstRow / mcuHeight, (lastRow + mcuHeight - 1) / mcuHeight);
+
+			if (!strips.empty() && strip.first <= strips[0].second && strips[0].first <= strip.second) strips[0] = std::make_pair(0, layout.NumMcuRows());
+			else strips.push_back(strip);
+		}
+
+		return strips;
+	}
+
+	//Decodes the blocks, patches the bands in them and encodes them again
+	bool PatchMcuRows(const JpegLayout& layout, McuRowBlocks& blocks, const PatchSettings& nadir, const PatchSettings& zenith)
+	{
+		std::vector<uchar> data;
+		if (!WriteMcuRows(layout, blocks, data)) return false;
+
+		//Decoded the same way as cv::imread() decodes the whole file
+		cv::Mat band = cv::imdecode(data, CV_LOAD_IMAGE_COLOR);
+		if (band.empty()) return false;
+
+		//Same order and placement as in PanoProcessing::Process()
+		int stripFirstRow = blocks.FirstMcuRow() * layout.McuHeight();
+		const PatchSettings* settings[2] = { &nadir, &zenith };
+		for (int k = 0; k < 2; k++)
+		{
+			int bandRows = PanoProcessing::PatchHeight(*settings[k], layout.height);
+			int firstRow = settings[k]->fNadir ? layout.height - bandRows : 0;
+			if (bandRows == 0 || firstRow < stripFirstRow || firstRow + bandRows > stripFirstRow + band.rows) continue;
+
+			cv::Mat dest(band, cv::Rect(0, firstRow - stripFirstRow, band.cols, bandRows));
+			PanoProcessing::PatchBand(dest, *settings[k]);
+		}
+
+		cv::cvtColor(band, band, cv::COLOR_BGR2RGB);
+		return EncodeLike(layout, band, data) && ReadMcuRows(layout, data, blocks);
+	}
+
+	//Patches a file in place of the coded data: only the patched MCU rows are decoded and coded again
+	//Returns false for files JpegScan can't handle, and when the new blocks need codes the file's Huffman tables lack
+	bool SpliceFile(const BString& srcFilename, const BString& dstFilename, const PatchSettings& nadir, const PatchSettings& zenith,
+		const std::vector<std::string>& app1Segments)
+	{
+		JpegScan scan;
+		if (!scan.Open(srcFilename)) return false;
+
+		const JpegLayout& layout = scan.Layout();
+		std::vector<std::pair<int, int>> strips = PatchStrips(layout, nadir, zenith);
+		std::vector<McuRowBlocks> blocks(strips.size());
+		std::vector<const McuRowBlocks*> replacements;
+
+		for (size_t k = 0; k < strips.size(); k++)
+		{
+			blocks[k].Init(layout, strips[k].first, strips[k].second - strips[k].first);
+			if (!scan.ReadMcuRows(blocks[k]) || !PatchMcuRows(layout, blocks[k], nadir, zenith)) return false;
+			replacements.push_back(&blocks[k]);
+		}
+
+		return scan.Write(dstFilename, replacements, app1Segments);
+	}
+}
+
+//Only the JPEG headers are read
+int JpegLossless::ColumnStep(const BString& filename, cv::Size& size)
+{
+	size = cv::Size();
+
+	FILE* file = fopen(filename.c_str(), "rb");
+	if (!file) return 0;
+
+	jpeg_decompress_struct cinfo;
+	JpegErrorManager err;
+	InitJpegErrorManager(err);
+	cinfo.err = &err.pub;
+	jpeg_create_decompress(&cinfo);
+
+	if (setjmp(err.jump))
+	{
+		jpeg_destroy_decompress(&cinfo);
+		fclose(file);
+		return 0;
+	}
+
+	jpeg_stdio_src(&cinfo, file);
+	jpeg_read_header(&cinfo, TRUE);
+
+	size = cv::Size(int(cinfo.image_width), int(cinfo.image_height));
+	int step = McuWidth(cinfo);
+
+	jpeg_destroy_decompress(&cinfo);
+	fclose(file);
+
+	//cv::imread turns images with an EXIF orientation, the DCT blocks are stored unturned
+	ImageHeader header;
+	if (step > 0 && (!PanoProcessing::ReadImageHeader(filename, header, false) || header.orientation != 1)) return 0;
+
+	return step;
+}
+
+bool JpegLossless::RotateFile(const BString& srcFilename, const BString& dstFilename, int numPixels,
+	const std::vector<std::string>& app1Segments)
+{
+	return PatchFile(srcFilename, dstFilename, numPixels, PatchSettings(), PatchSettings(), app1Segments);
+}
+
+//Without a rotation, the coded data of the unpatched rows is spliced into the new file as it is
+//Otherwise the coefficients are read into libjpeg's virtual arrays, shifted there row by row, the patched MCU rows
+//are replaced, and everything is written with Huffman tables optimized for the new DC differences
+bool JpegLossless::PatchFile(const BString& srcFilename, const BString& dstFilename, int numPixels,
+	const PatchSettings& nadir, const PatchSettings& zenith, const std::vector<std::string>& app1Segments)
+{
+	if (numPixels == 0 && SpliceFile(srcFilename, dstFilename, nadir, zenith, app1Segments)) return true;
+
+	FILE* srcFile = fopen(srcFilename.c_str(), "rb");
+	if (!srcFile) return false;
+
+	FILE* dstFile = fopen(dstFilename.c_str(), "wb");
+	if (!dstFile)
+	{
+		fclose(srcFile);
+		return false;
+	}
+
+	jpeg_decompress_struct srcInfo;
+	jpeg_compress_struct dstInfo;
+	JpegErrorManager err;
+	InitJpegErrorManager(err);
+	srcInfo.err = &err.pub;
+	dstInfo.err = &err.pub;
+	jpeg_create_decompress(&srcInfo);
+	jpeg_create_compress(&dstInfo);
+
+	std::vector<JCOEF> scratch;
+
+	if (setjmp(err.jump))
+	{
+		jpeg_destroy_compress(&dstInfo);
+		jpeg_destroy_decompress(&srcInfo);
+		fclose(srcFile);
+		fclose(dstFile);
+		remove(dstFilename.c_str());
+		return false;
+	}
+
+	jpeg_stdio_src(&srcInfo, srcFile);
+	jpeg_read_header(&srcInfo, TRUE);
+
+	int mcuWidth = McuWidth(srcInfo);
+	if (mcuWidth == 0 || numPixels % mcuWidth != 0) longjmp(err.jump, 1);
+
+	jvirt_barray_ptr* coefArrays = jpeg_read_coefficients(&srcInfo);
+
+	ForEachBlockRow(srcInfo, coefArrays, true, [&](JBLOCKROW row, int c, int)
+	{
+		jpeg_component_info& comp = srcInfo.comp_info[c];
+		ShiftBlockRow(row, int(comp.width_in_blocks), BlockShift(srcInfo, comp, numPixels), scratch);
+	});
+
+	//Patches are filled in color, so they can't go into grayscale or CMYK files
+	bool fPatch = PanoProcessing::PatchHeight(nadir, int(srcInfo.image_height)) > 0 ||
+		PanoProcessing::PatchHeight(zenith, int(srcInfo.image_height)) > 0;
+	if (fPatch && (srcInfo.jpeg_color_space != JCS_YCbCr || srcInfo.num_components != 3)) longjmp(err.jump, 1);
+
+	JpegLayout layout = LayoutOf(srcInfo);
+	for (auto& strip : PatchStrips(layout, nadir, zenith))
+	{
+		McuRowBlocks blocks;
+		blocks.Init(layout, strip.first, strip.second - strip.first);
+		CopyMcuRows((j_common_ptr)&srcInfo, coefArrays, 0, layout, blocks, false);
+		if (!PatchMcuRows(layout, blocks, nadir, zenith)) longjmp(err.jump, 1);
+		CopyMcuRows((j_common_ptr)&srcInfo, coefArrays, 0, layout, blocks, true);
+	}
+
+	jpeg_copy_critical_parameters(&srcInfo, &dstInfo);
+	dstInfo.optimize_coding = TRUE;
+
+	jpeg_stdio_dest(&dstInfo, dstFile);
+	jpeg_write_coefficients(&dstInfo, coefArrays);
+	for (const std::string& segment : app1Segments) jpeg_write_marker(&dstInfo, JPEG_APP0 + 1, (const JOCTET*)segment.data(), unsigned(segment.size()));
+	jpeg_finish_compress(&dstInfo);
+	jpeg_finish_decompress(&srcInfo);
+
+	jpeg_destroy_compress(&dstInfo);
+	jpeg_destroy_decompress(&srcInfo);
+	fclose(srcFile);
+
+	//Write errors of the last buffer only show up here
+	return fclose(dstFile) == 0;
+}
+
+bool JpegLossless::ProcessFile(const BString& srcFilename, const BString& dstFilename, double rotationRad, bool fSnap,
+	const RescaleSettings& rescale, const PatchSettings& nadir, const PatchSettings& zenith, cv::Size& size, bool& fTagged)
+{
+	fTagged = false;
+
+	int step = ColumnStep(srcFilename, size);
+	if (step == 0 || PanoProcessing::RescaledSize(size, rescale) != size) return false;
+
+	int shift = PanoProcessing::RotationPixels(size.width, rotationRad) % size.width;
+	if (shift < 0) shift += size.width;
+	if (fSnap) shift = (shift + step / 2) / step * step;
+	if (shift % step != 0) return false;
+
+	std::vector<std::string> app1Segments = JpegScan::App1Segments(PanoProcessing::PanoramaExifBlock(size), PanoProcessing::PanoramaXmpPacket(size));
+	if (!PatchFile(srcFilename, dstFilename, shift, nadir, zenith, app1Segments)) return false;
+
+	fTagged = app1Segments.size() == 2;
+	return true;
+}
+
+//Both files are read to the coefficients; the source rows are shifted in their buffer and compared
+bool JpegLossless::VerifyRotation(const BString& srcFilename, const BString& dstFilename, int numPixels)
+{
+	FILE* srcFile = fopen(srcFilename.c_str(), "rb");
+	if (!srcFile) return false;
+
+	FILE* dstFile = fopen(dstFilename.c_str(), "rb");
+	if (!dstFile)
+	{
+		fclose(srcFile);
+		return false;
+	}
+
+	jpeg_decompress_struct srcInfo, dstInfo;
+	JpegErrorManager err;
+	InitJpegErrorManager(err);
+	srcInfo.err = &err.pub;
+	dstInfo.err = &err.pub;
+	jpeg_create_decompress(&srcInfo);
+	jpeg_create_decompress(&dstInfo);
+
+	std::vector<JCOEF> scratch;
+	bool fSame = true;
+
+	if (setjmp(err.jump))
+	{
+		jpeg_destroy_decompress(&dstInfo);
+		jpeg_destroy_decompress(&srcInfo);
+		fclose(srcFile);
+		fclose(dstFile);
+		return false;
+	}
+
+	jpeg_stdio_src(&srcInfo, srcFile);
+	jpeg_stdio_src(&dstInfo, dstFile);
+	jpeg_read_header(&srcInfo, TRUE);
+	jpeg_read_header(&dstInfo, TRUE);
+
+	fSame = McuWidth(srcInfo) != 0 && numPixels % McuWidth(srcInfo) == 0 &&
+		srcInfo.image_width == dstInfo.image_width && srcInfo.image_height == dstInfo.image_height &&
+		srcInfo.num_components == dstInfo.num_components;
+
+	for (int c = 0; fSame && c < srcInfo.num_components; c++)
+	{
+		const jpeg_component_info& srcComp = srcInfo.comp_info[c];
+		const jpeg_component_info& dstComp = dstInfo.comp_info[c];
+
+		fSame = srcComp.h_samp_factor == dstComp.h_samp_factor && srcComp.v_samp_factor == dstComp.v_samp_factor &&
+			srcComp.quant_tbl_no == dstComp.quant_tbl_no;
+	}
+
+	if (fSame)
+	{
+		jvirt_barray_ptr* srcArrays = jpeg_read_coefficients(&srcInfo);
+		jvirt_barray_ptr* dstArrays = jpeg_read_coefficients(&dstInfo);
+
+		//The quantization tables must match too, or equal coefficients mean different pixels
+		for (int c = 0; fSame && c < srcInfo.num_components; c++)
+		{
+			const JQUANT_TBL* srcTable = srcInfo.comp_info[c].quant_table;
+			const JQUANT_TBL* dstTable = dstInfo.comp_info[c].quant_table;
+			fSame = srcTable && dstTable && memcmp(srcTable->quantval, dstTable->quantval, sizeof(srcTable->quantval)) == 0;
+		}
+
+		ForEachBlockRow(srcInfo, srcArrays, true, [&](JBLOCKROW srcRow, int c, int y)
+		{
+			if (!fSame) return;
+
+			jpeg_component_info& comp = srcInfo.comp_info[c];
+			int widthInBlocks = int(comp.width_in_blocks);
+			ShiftBlockRow(srcRow, widthInBlocks, BlockShift(srcInfo, comp, numPixels), scratch);
+
+			JBLOCKARRAY dstRows = (*dstInfo.mem->access_virt_barray)((j_common_ptr)&dstInfo, dstArrays[c],
+				JDIMENSION(y), 1, FALSE);
+			fSame = memcmp(srcRow, dstRows[0], widthInBlocks * sizeof(JBLOCK)) == 0;
+		});
+
+		jpeg_finish_decompress(&dstInfo);
+		jpeg_finish_decompress(&srcInfo);
+	}
+
+	jpeg_destroy_decompress(&dstInfo);
+	jpeg_destroy_decompress(&srcInfo);
+	fclose(srcFile);
+	fclose(dstFile);
+
+	return fSame;
+}
@@ -0,0 +1,67 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+
+//Lossless yaw rotation and partial re-encoding of JPEG panoramas
+//A rotation is a horizontal cyclic shift; if it moves the image by whole MCU columns, the quantized DCT blocks
+//can be moved instead of the pixels. Only the Huffman coding is redone, so there is no generation loss.
+//Nadir and zenith patches only change whole rows at the top and the bottom, so only the MCU rows
+//that intersect them are decoded and encoded again; the blocks of all other rows are copied,
+//and without a rotation, so is their Huffman-coded data
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include "BString.h"
+#include "PanoProcessing.h"
+
+namespace JpegLossless
+{
+	//Width of an MCU column of the file in pixels; the file can be rotated losslessly by multiples of it
+	//size receives the size of the image
+	//Returns 0 if the file is not a JPEG, its width is not a whole number of MCU columns,
+	//or it has an EXIF orientation that cv::imread would apply
+	int ColumnStep(const BString& filename, cv::Size& size);
+
+	//Writes the image of srcFilename cyclically shifted by numPixels to the right into dstFilename
+	//numPixels must be a multiple of ColumnStep(); no metadata is copied, app1Segments (see JpegScan::App1Segments())
+	//are written instead. Returns false if the source can't be read or the result written
+	bool RotateFile(const BString& srcFilename, const BString& dstFilename, int numPixels,
+		const std::vector<std::string>& app1Segments);
+
+	//Same as RotateFile(), followed by PanoProcessing::Patch() with nadir and then zenith
+	//Only YCbCr color files can be patched; returns false for the others
+	bool PatchFile(const BString& srcFilename, const BString& dstFilename, int numPixels,
+		const PatchSettings& nadir, const PatchSettings& zenith, const std::vector<std::string>& app1Segments);
+
+	//Same result as PanoProcessing::Process() on the decoded file, done with PatchFile() if the file allows it:
+	//a JPEG that does not need rescaling. With fSnap, the rotation is rounded to whole MCU columns,
+	//otherwise it must already be a multiple of them. size receives the size of the image
+	//The EXIF size tags and GPano XMP of PanoProcessing::InsertExifTags() are written with the image; fTagged receives whether they were
+	//Returns false if the file has to be decoded instead; nothing is written then
+	bool ProcessFile(const BString& srcFilename, const BString& dstFilename, double rotationRad, bool fSnap,
+		const RescaleSettings& rescale, const PatchSettings& nadir, const PatchSettings& zenith, cv::Size& size, bool& fTagged);
+
+	//Checks that the DCT blocks of dstFilename are those of srcFilename shifted by numPixels
+	//Then each block decodes to the same pixels in both files; with subsampled chroma, the upsampling
+	//may still round differently in the pixel columns at both sides of the seams
+	bool VerifyRotation(const BString& srcFilename, const BString& dstFilename, int numPixels);
+};
@@ -0,0 +1,820 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+
+#include "JpegScan.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+namespace
+{
+	//Position of each zigzag index in a block
+	const int naturalOrder[64] =
+	{
+		0,  1,  8, 16,  9,  2,  3, 10,
+		17, 24, 32, 25, 18, 11,  4,  5,
+		12, 19, 26, 33, 40, 48, 41, 34,
+		27, 20, 13,  6,  7, 14, 21, 28,
+		35, 42, 49, 56, 57, 50, 43, 36,
+		29, 22, 15, 23, 30, 37, 44, 51,
+		58, 59, 52, 45, 38, 31, 39, 46,
+		53, 60, 61, 54, 47, 55, 62, 63
+	};
+
+	enum
+	{
+		SOF0 = 0xC0, SOF1 = 0xC1, DHT = 0xC4, RST0 = 0xD0, RST7 = 0xD7, SOI = 0xD8, EOI = 0xD9,
+		SOS = 0xDA, DQT = 0xDB, DRI = 0xDD, APP0 = 0xE0, APP1 = 0xE1, APP14 = 0xEE
+	};
+
+	int ReadUInt16(const uint8_t* p) { return (p[0] << 8) | p[1]; }
+
+	//Reads coded data bits, skips the zero bytes stuffed after 0xFF
+	//Stops at a marker and returns zero bits from there, as libjpeg does
+	class BitReader
+	{
+	public:
+		BitReader(const std::vector<uint8_t>& data, size_t theEnd, size_t thePos) :
+			bytes(data.data()), end(theEnd), pos(thePos), acc(0), numBits(0), bitsRead(0) {}
+
+		BitReader(const std::vector<uint8_t>& data, size_t theEnd, const JpegScan::Position& position) :
+			bytes(data.data()), end(theEnd), pos(position.pos), acc(position.acc), numBits(position.numBits),
+			bitsRead(position.bitsRead) {}
+
+		void Save(JpegScan::Position& position) const
+		{
+			position.pos = pos;
+			position.acc = acc;
+			position.numBits = numBits;
+			position.bitsRead = bitsRead;
+		}
+
+		//n is up to 16
+		int Peek(int n)
+		{
+			if (numBits < n) Fill();
+			return int(acc >> (numBits - n)) & ((1 << n) - 1);
+		}
+
+		void Skip(int n)
+		{
+			numBits -= n;
+			bitsRead += n;
+		}
+
+		int Get(int n)
+		{
+			int value = Peek(n);
+			Skip(n);
+			return value;
+		}
+
+		uint64_t BitsRead() const { return bitsRead; }
+
+	private:
+		void Fill()
+		{
+			while (numBits <= 56)
+			{
+				uint8_t byte = 0;
+				if (pos < end)
+				{
+					byte = bytes[pos];
+					if (byte != 0xFF) pos++;
+					else if (pos + 1 < end && bytes[pos + 1] == 0) pos += 2;
+					else byte = 0;
+				}
+
+				acc = (acc << 8) | byte;
+				numBits += 8;
+			}
+		}
+
+	private:
+		const uint8_t* bytes;
+		size_t end;
+		size_t pos;
+		uint64_t acc;
+		int numBits;
+		uint64_t bitsRead;
+	};
+
+	//Writes coded data bits, stuffs a zero byte after each 0xFF
+	class BitWriter
+	{
+	public:
+		BitWriter(std::vector<uint8_t>& theOut) : out(theOut), acc(0), numBits(0) {}
+
+		//n is up to 16
+		void Put(uint32_t bits, int n)
+		{
+			acc = (acc << n) | (bits & ((1u << n) - 1));
+			numBits += n;
+
+			while (numBits >= 8)
+			{
+				numBits -= 8;
+				uint8_t byte = uint8_t(acc >> numBits);
+				out.push_back(byte);
+				if (byte == 0xFF) out.push_back(0);
+			}
+		}
+
+		//Pads the last byte with 1 bits
+		void Flush()
+		{
+			int n = (8 - numBits % 8) % 8;
+			if (n > 0) Put((1u << n) - 1, n);
+		}
+
+		//Only at byte boundaries
+		void PutBytes(const uint8_t* bytes, size_t n) { out.insert(out.end(), bytes, bytes + n); }
+
+	private:
+		std::vector<uint8_t>& out;
+		uint64_t acc;
+		int numBits;
+	};
+
+	//Negative values are coded as their one's complement
+	int Extend(int bits, int n)
+	{
+		return bits < (1 << (n - 1)) ? bits - (1 << n) + 1 : bits;
+	}
+
+	int NumBits(int value)
+	{
+		if (value < 0) value = -value;
+		int n = 0;
+		for (; value != 0; value >>= 1) n++;
+		return n;
+	}
+
+	//Returns the symbol, -1 for an invalid code
+	int DecodeSymbol(BitReader& reader, const JpegScan::HuffTable& table)
+	{
+		int entry = table.lookup[reader.Peek(9)];
+		if (entry != 0)
+		{
+			reader.Skip(entry >> 8);
+			return entry & 0xFF;
+		}
+
+		for (int length = 10; length <= 16; length++)
+		{
+			int code = reader.Peek(length);
+			if (code <= table.maxCode[length])
+			{
+				reader.Skip(length);
+				return table.values[table.valueOffset[length] + code];
+			}
+		}
+
+		return -1;
+	}
+
+	bool EncodeSymbol(BitWriter& writer, const JpegScan::HuffTable& table, int symbol)
+	{
+		if (table.codeLength[symbol] == 0) return false;
+		writer.Put(table.code[symbol], table.codeLength[symbol]);
+		return true;
+	}
+
+	//Decodes one block into coefs, or skips it if coefs is null
+	bool DecodeBlock(BitReader& reader, const JpegScan::HuffTable& dc, const JpegScan::HuffTable& ac, int& pred, short* coefs)
+	{
+		int n = DecodeSymbol(reader, dc);
+		if (n < 0 || n > 15) return false;
+		if (n > 0) pred += Extend(reader.Get(n), n);
+
+		if (coefs)
+		{
+			memset(coefs, 0, 64 * sizeof(short));
+			coefs[0] = short(pred);
+		}
+
+		for (int k = 1; k < 64; k++)
+		{
+			int symbol = DecodeSymbol(reader, ac);
+			if (symbol < 0) return false;
+
+			int run = symbol >> 4;
+			n = symbol & 15;
+
+			if (n == 0)
+			{
+				if (run != 15) break;
+				k += 15;
+				continue;
+			}
+
+			k += run;
+			if (k > 63) return false;
+
+			int value = Extend(reader.Get(n), n);
+			if (coefs) coefs[naturalOrder[k]] = short(value);
+		}
+
+		return true;
+	}
+
+	//Same as DecodeBlock() with no coefs, but AC values are skipped together with their codes where possible
+	bool SkipBlock(BitReader& reader, const JpegScan::HuffTable& dc, const JpegScan::HuffTable& ac, int& pred)
+	{
+		int n = DecodeSymbol(reader, dc);
+		if (n < 0 || n > 15) return false;
+		if (n > 0) pred += Extend(reader.Get(n), n);
+
+		for (int k = 1; k < 64; k++)
+		{
+			int symbol;
+			int entry = ac.skip[reader.Peek(11)];
+			if (entry != 0)
+			{
+				reader.Skip(entry >> 8);
+				symbol = entry & 0xFF;
+			}
+			else
+			{
+				symbol = DecodeSymbol(reader, ac);
+				if (symbol < 0) return false;
+				reader.Skip(symbol & 15);
+			}
+
+			if ((symbol & 15) == 0)
+			{
+				if (symbol != 0xF0) break;
+				k += 15;
+				continue;
+			}
+
+			k += symbol >> 4;
+			if (k > 63) return false;
+		}
+
+		return true;
+	}
+
+	bool EncodeBlock(BitWriter& writer, const JpegScan::HuffTable& dc, const JpegScan::HuffTable& ac, int& pred, const short* coefs)
+	{
+		int diff = coefs[0] - pred;
+		pred = coefs[0];
+
+		int n = NumBits(diff);
+		if (!EncodeSymbol(writer, dc, n)) return false;
+		if (n > 0) writer.Put(diff < 0 ? diff - 1 : diff, n);
+
+		int run = 0;
+		for (int k = 1; k < 64; k++)
+		{
+			int value = coefs[naturalOrder[k]];
+			if (value == 0)
+			{
+				run++;
+				continue;
+			}
+
+			for (; run > 15; run -= 16)
+			{
+				if (!EncodeSymbol(writer, ac, 0xF0)) return false;
+			}
+
+			n = NumBits(value);
+			if (!EncodeSymbol(writer, ac, (run << 4) | n)) return false;
+			writer.Put(value < 0 ? value - 1 : value, n);
+			run = 0;
+		}
+
+		//End of block
+		return run == 0 || EncodeSymbol(writer, ac, 0);
+	}
+
+	bool ReadFile(const BString& filename, std::vector<uint8_t>& data)
+	{
+		FILE* file = fopen(filename.c_str(), "rb");
+		if (!file) return false;
+
+		fseek(file, 0, SEEK_END);
+		long size = ftell(file);
+		fseek(file, 0, SEEK_SET);
+
+		data.resize(size > 0 ? size_t(size) : 0);
+		bool fOk = size > 0 && fread(data.data(), 1, data.size(), file) == data.size();
+		fclose(file);
+		return fOk;
+	}
+}
+
+void McuRowBlocks::Init(const JpegLayout& layout, int theFirstMcuRow, int theNumMcuRows)
+{
+	firstMcuRow = theFirstMcuRow;
+	numMcuRows = theNumMcuRows;
+	numComponents = layout.numComponents;
+
+	for (int c = 0; c < numComponents; c++)
+	{
+		blockRows[c] = numMcuRows * layout.v[c];
+		blockCols[c] = layout.McusPerRow() * layout.h[c];
+		coefs[c].assign(size_t(blockRows[c]) * blockCols[c] * 64, 0);
+	}
+}
+
+bool JpegScan::HuffTable::Build(const uint8_t* counts, const uint8_t* symbols, int numSymbols)
+{
+	values.assign(symbols, symbols + numSymbols);
+	memset(lookup, 0, sizeof(lookup));
+	memset(skip, 0, sizeof(skip));
+	memset(codeLength, 0, sizeof(codeLength));
+
+	//Canonical codes: consecutive within a length, shifted left by one for the next length
+	int nextCode = 0;
+	int k = 0;
+	for (int length = 1; length <= 16; length++)
+	{
+		valueOffset[length] = k - nextCode;
+
+		for (int i = 0; i < counts[length - 1]; i++, k++, nextCode++)
+		{
+			code[values[k]] = uint16_t(nextCode);
+			codeLength[values[k]] = uint8_t(length);
+
+			if (length <= 9)
+			{
+				int first = nextCode << (9 - length);
+				for (int j = 0; j < (1 << (9 - length)); j++) lookup[first + j] = uint16_t((length << 8) | values[k]);
+			}
+
+			int skipLength = length + (values[k] & 15);
+			if (skipLength <= 11)
+			{
+				int first = nextCode << (11 - length);
+				for (int j = 0; j < (1 << (11 - length)); j++) skip[first + j] = uint16_t((skipLength << 8) | values[k]);
+			}
+		}
+
+		maxCode[length] = counts[length - 1] > 0 ? nextCode - 1 : -1;
+
+		//A code of all 1 bits is not allowed
+		if (nextCode >= (1 << length)) return false;
+		nextCode <<= 1;
+	}
+
+	maxCode[17] = 0x7FFFFFFF;
+	fDefined = true;
+	return true;
+}
+
+//Reads up to the coded data of the first scan and makes sure the rest of the file is just its end
+bool JpegScan::ParseHeaders()
+{
+	if (data.size() < 4 || data[0] != 0xFF || data[1] != SOI) return false;
+
+	bool fFrame = false;
+	bool fYCbCr = true;
+	bool fQuant[4] = { false, false, false, false };
+	uint16_t quantTables[4][64];
+	int componentIds[JpegLayout::MaxComponents];
+	int quantTableNumbers[JpegLayout::MaxComponents];
+
+	size_t pos = 2;
+	for (;;)
+	{
+		while (pos < data.size() && data[pos] == 0xFF && pos + 1 < data.size() && data[pos + 1] == 0xFF) pos++;
+		if (pos + 4 > data.size() || data[pos] != 0xFF) return false;
+
+		int marker = data[pos + 1];
+		int length = ReadUInt16(&data[pos + 2]);
+		const uint8_t* p = &data[pos + 4];
+		size_t segmentEnd = pos + 2 + length;
+		if (length < 2 || segmentEnd > data.size()) return false;
+
+		if (marker == SOF0 || marker == SOF1)
+		{
+			if (length < 8 || p[0] != 8) return false;
+			layout.height = ReadUInt16(p + 1);
+			layout.width = ReadUInt16(p + 3);
+			layout.numComponents = p[5];
+			if (layout.width == 0 || layout.height == 0 || layout.numComponents != 3 || length < 8 + 3 * layout.numComponents) return false;
+
+			for (int c = 0; c < layout.numComponents; c++)
+			{
+				componentIds[c] = p[6 + 3 * c];
+				layout.h[c] = p[7 + 3 * c] >> 4;
+				layout.v[c] = p[7 + 3 * c] & 15;
+				quantTableNumbers[c] = p[8 + 3 * c];
+				if (layout.h[c] < 1 || layout.h[c] > 4 || layout.v[c] < 1 || layout.v[c] > 4 || quantTableNumbers[c] > 3) return false;
+
+				layout.maxH = std::max(layout.maxH, layout.h[c]);
+				layout.maxV = std::max(layout.maxV, layout.v[c]);
+			}
+
+			//libjpeg takes these ids for RGB
+			if (componentIds[0] == 'R' && componentIds[1] == 'G' && componentIds[2] == 'B') fYCbCr = false;
+			fFrame = true;
+		}
+		else if ((marker >= 0xC2 && marker <= 0xCF && marker != DHT && marker != 0xC8 && marker != 0xCC))
+		{
+			//Progressive, lossless, hierarchical or arithmetic-coded
+			return false;
+		}
+		else if (marker == DHT)
+		{
+			for (const uint8_t* q = p; q < &data[segmentEnd];)
+			{
+				if (q + 17 > &data[segmentEnd]) return false;
+
+				int tableClass = q[0] >> 4;
+				int tableNumber = q[0] & 15;
+				int numSymbols = 0;
+				for (int i = 1; i <= 16; i++) numSymbols += q[i];
+				if (tableClass > 1 || tableNumber > 3 || numSymbols > 256 || q + 17 + numSymbols > &data[segmentEnd]) return false;
+
+				HuffTable& table = tableClass == 0 ? dcTables[tableNumber] : acTables[tableNumber];
+				if (!table.Build(q + 1, q + 17, numSymbols)) return false;
+				q += 17 + numSymbols;
+			}
+		}
+		else if (marker == DQT)
+		{
+			for (const uint8_t* q = p; q < &data[segmentEnd];)
+			{
+				int precision = q[0] >> 4;
+				int tableNumber = q[0] & 15;
+				if (tableNumber > 3 || q + 1 + 64 * (precision + 1) > &data[segmentEnd]) return false;
+
+				for (int k = 0; k < 64; k++)
+				{
+					quantTables[tableNumber][naturalOrder[k]] = uint16_t(precision ? ReadUInt16(q + 1 + 2 * k) : q[1 + k]);
+				}
+
+				fQuant[tableNumber] = true;
+				q += 1 + 64 * (precision + 1);
+			}
+		}
+		else if (marker == DRI)
+		{
+			if (length < 4) return false;
+			restartInterval = ReadUInt16(p);
+		}
+		else if (marker == APP14)
+		{
+			//Adobe marker, transform 0 means the components are not YCbCr
+			if (length >= 14 && memcmp(p, "Adobe", 5) == 0 && p[11] == 0) fYCbCr = false;
+		}
+		else if (marker == SOS)
+		{
+			if (!fFrame || !fYCbCr || length < 6 + 2 * p[0] || p[0] != layout.numComponents) return false;
+
+			//All components interleaved in the frame order, the whole spectrum at once
+			for (int c = 0; c < layout.numComponents; c++)
+			{
+				if (p[1 + 2 * c] != componentIds[c]) return false;
+				dcTable[c] = p[2 + 2 * c] >> 4;
+				acTable[c] = p[2 + 2 * c] & 15;
+				if (dcTable[c] > 3 || acTable[c] > 3 || !dcTables[dcTable[c]].fDefined || !acTables[acTable[c]].fDefined) return false;
+			}
+
+			const uint8_t* spectral = p + 1 + 2 * layout.numComponents;
+			if (spectral[0] != 0 || spectral[1] != 63 || spectral[2] != 0) return false;
+
+			scanStart = segmentEnd;
+			break;
+		}
+		else if (marker == SOI || marker == EOI || (marker >= RST0 && marker <= RST7))
+		{
+			return false;
+		}
+
+		pos = segmentEnd;
+	}
+
+	for (int c = 0; c < layout.numComponents; c++)
+	{
+		if (!fQuant[quantTableNumbers[c]]) return false;
+		memcpy(layout.quant[c], quantTables[quantTableNumbers[c]], sizeof(layout.quant[c]));
+	}
+
+	//The scan ends at the first marker other than a restart marker, which must be the end of the image
+	//Restart markers are collected on the way
+	size_t numMcus = size_t(layout.McusPerRow()) * layout.NumMcuRows();
+	segmentStarts.assign(1, scanStart);
+
+	for (scanEnd = scanStart; scanEnd + 1 < data.size(); scanEnd++)
+	{
+		const void* next = memchr(&data[scanEnd], 0xFF, data.size() - 1 - scanEnd);
+		if (!next) scanEnd = data.size() - 1;
+		else scanEnd = static_cast<const uint8_t*>(next) - data.data();
+
+		if (scanEnd + 1 >= data.size() || data[scanEnd + 1] == 0 || data[scanEnd + 1] == 0xFF) continue;
+		if (data[scanEnd + 1] < RST0 || data[scanEnd + 1] > RST7) break;
+
+		segmentStarts.push_back(scanEnd + 2);
+		scanEnd++;
+	}
+
+	if (scanEnd + 1 >= data.size() || data[scanEnd + 1] != EOI) return false;
+
+	if (restartInterval == 0)
+	{
+		if (segmentStarts.size() != 1) return false;
+		segmentStarts.clear();
+	}
+	else
+	{
+		if (segmentStarts.size() != (numMcus + restartInterval - 1) / restartInterval) return false;
+		segmentStarts.push_back(scanEnd);
+	}
+
+	return true;
+}
+
+//Without restart markers, all the Huffman codes have to be walked through to find where the MCU rows start
+bool JpegScan::FindRows()
+{
+	if (restartInterval != 0) return true;
+
+	int mcusPerRow = layout.McusPerRow();
+	int numMcuRows = layout.NumMcuRows();
+	rowPositions.resize(numMcuRows + 1);
+
+	BitReader reader(data, scanEnd, scanStart);
+	int preds[JpegLayout::MaxComponents] = { 0 };
+
+	for (int row = 0; row <= numMcuRows; row++)
+	{
+		Position& position = rowPositions[row];
+		reader.Save(position);
+		memcpy(position.preds, preds, sizeof(preds));
+		if (row == numMcuRows) break;
+
+		for (int col = 0; col < mcusPerRow; col++)
+		{
+			for (int c = 0; c < layout.numComponents; c++)
+			{
+				for (int b = 0; b < layout.h[c] * layout.v[c]; b++)
+				{
+					if (!SkipBlock(reader, dcTables[dcTable[c]], acTables[acTable[c]], preds[c])) return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+bool JpegScan::Open(const BString& filename)
+{
+	data.clear();
+	layout = JpegLayout();
+	restartInterval = 0;
+	for (int k = 0; k < 4; k++) dcTables[k].fDefined = acTables[k].fDefined = false;
+
+	return ReadFile(filename, data) && ParseHeaders() && FindRows();
+}
+
+bool JpegScan::ReadMcuRows(McuRowBlocks& blocks) const
+{
+	int mcusPerRow = layout.McusPerRow();
+	size_t firstMcu = size_t(blocks.FirstMcuRow()) * mcusPerRow;
+	size_t lastMcu = size_t(blocks.LastMcuRow()) * mcusPerRow;
+
+	//With restart markers, decoding starts at the interval the first row is in
+	size_t mcu = restartInterval ? firstMcu / restartInterval * restartInterval : firstMcu;
+	BitReader reader = restartInterval ? BitReader(data, scanEnd, segmentStarts[mcu / restartInterval]) :
+		BitReader(data, scanEnd, rowPositions[blocks.FirstMcuRow()]);
+
+	int preds[JpegLayout::MaxComponents] = { 0 };
+	if (!restartInterval) memcpy(preds, rowPositions[blocks.FirstMcuRow()].preds, sizeof(preds));
+
+	for (; mcu < lastMcu; mcu++)
+	{
+		if (restartInterval && mcu % restartInterval == 0)
+		{
+			reader = BitReader(data, scanEnd, segmentStarts[mcu / restartInterval]);
+			memset(preds, 0, sizeof(preds));
+		}
+
+		int row = int(mcu / mcusPerRow) - blocks.FirstMcuRow();
+		int col = int(mcu % mcusPerRow);
+
+		for (int c = 0; c < layout.numComponents; c++)
+		{
+			for (int y = 0; y < layout.v[c]; y++)
+			{
+				for (int x = 0; x < layout.h[c]; x++)
+				{
+					short* coefs = mcu >= firstMcu ? blocks.Block(c, row * layout.v[c] + y, col * layout.h[c] + x) : nullptr;
+					if (!DecodeBlock(reader, dcTables[dcTable[c]], acTables[acTable[c]], preds[c], coefs)) return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+std::vector<std::string> JpegScan::App1Segments(const std::string& exifBlock, const std::string& xmpPacket)
+{
+	//The identifiers end with zero bytes, which sizeof counts
+	static const char exifId[] = "Exif\0";
+	static const char xmpNamespace[] = "http://ns.adobe.com/xap/1.0/";
+
+	//The segment length counts its own two bytes
+	std::vector<std::string> segments;
+	if (!exifBlock.empty() && sizeof(exifId) + exifBlock.size() <= 0xFFFF - 2) segments.push_back(std::string(exifId, sizeof(exifId)) + exifBlock);
+	if (!xmpPacket.empty() && sizeof(xmpNamespace) + xmpPacket.size() <= 0xFFFF - 2) segments.push_back(std::string(xmpNamespace, sizeof(xmpNamespace)) + xmpPacket);
+	return segments;
+}
+
+//ParseHeaders() has checked the segments, fill bytes between them are dropped
+//The new APP1 segments go after the APP0 ones, where JFIF readers expect nothing else
+void JpegScan::WriteHeaders(std::vector<uint8_t>& out, const std::vector<std::string>& app1Segments) const
+{
+	bool fApp1Written = false;
+
+	out.insert(out.end(), data.begin(), data.begin() + 2);
+
+	for (size_t pos = 2; pos < scanStart;)
+	{
+		while (data[pos + 1] == 0xFF) pos++;
+
+		int marker = data[pos + 1];
+		size_t segmentEnd = pos + 2 + ReadUInt16(&data[pos + 2]);
+
+		if (marker != APP0 && !fApp1Written)
+		{
+			for (const std::string& segment : app1Segments)
+			{
+				size_t length = segment.size() + 2;
+				uint8_t header[4] = { 0xFF, APP1, uint8_t(length >> 8), uint8_t(length) };
+				out.insert(out.end(), header, header + 4);
+				out.insert(out.end(), segment.begin(), segment.end());
+			}
+			fApp1Written = true;
+		}
+
+		if (marker != APP1) out.insert(out.end(), data.begin() + pos, data.begin() + segmentEnd);
+		pos = segmentEnd;
+	}
+}
+
+//Without restart markers, the first MCU of an untouched run of rows is coded again for the new DC prediction,
+//and the rest of the run is copied bit by bit. With them, the restart intervals that have no new rows are copied
+//byte by byte, markers included, and the others are coded again
+bool JpegScan::Write(const BString& filename, const std::vector<const McuRowBlocks*>& replacements,
+	const std::vector<std::string>& app1Segments) const
+{
+	int mcusPerRow = layout.McusPerRow();
+	int numMcuRows = layout.NumMcuRows();
+	size_t numMcus = size_t(mcusPerRow) * numMcuRows;
+
+	//Replacement of each MCU row, if any
+	std::vector<const McuRowBlocks*> rowReplacements(numMcuRows, nullptr);
+	for (const McuRowBlocks* blocks : replacements)
+	{
+		for (int row = blocks->FirstMcuRow(); row < blocks->LastMcuRow() && row < numMcuRows; row++) rowReplacements[row] = blocks;
+	}
+
+	std::vector<uint8_t> out;
+	out.reserve(data.size() + data.size() / 16);
+	WriteHeaders(out, app1Segments);
+	BitWriter writer(out);
+
+	//Blocks of one MCU, decoded from the file
+	McuRowBlocks mcuBlocks;
+	JpegLayout mcuLayout = layout;
+	mcuLayout.width = mcuLayout.McuWidth();
+	mcuBlocks.Init(mcuLayout, 0, 1);
+
+	int preds[JpegLayout::MaxComponents] = { 0 };
+	int srcPreds[JpegLayout::MaxComponents] = { 0 };
+
+	//Decodes an MCU from reader if it is not replaced, and codes it again
+	auto recodeMcu = [&](BitReader& reader, size_t mcu) -> bool
+	{
+		int row = int(mcu / mcusPerRow);
+		int col = int(mcu % mcusPerRow);
+		const McuRowBlocks* blocks = rowReplacements[row];
+
+		for (int c = 0; c < layout.numComponents; c++)
+		{
+			for (int y = 0; y < layout.v[c]; y++)
+			{
+				for (int x = 0; x < layout.h[c]; x++)
+				{
+					const HuffTable& dc = dcTables[dcTable[c]];
+					const HuffTable& ac = acTables[acTable[c]];
+					const short* coefs = mcuBlocks.Block(c, y, x);
+
+					if (!DecodeBlock(reader, dc, ac, srcPreds[c], mcuBlocks.Block(c, y, x))) return false;
+					if (blocks) coefs = blocks->Block(c, (row - blocks->FirstMcuRow()) * layout.v[c] + y, col * layout.h[c] + x);
+					if (!EncodeBlock(writer, dc, ac, preds[c], coefs)) return false;
+				}
+			}
+		}
+
+		return true;
+	};
+
+	if (restartInterval)
+	{
+		size_t numSegments = segmentStarts.size() - 1;
+
+		for (size_t segment = 0; segment < numSegments; segment++)
+		{
+			size_t firstMcu = segment * restartInterval;
+			size_t lastMcu = std::min(firstMcu + restartInterval, numMcus);
+
+			bool fReplaced = false;
+			for (size_t row = firstMcu / mcusPerRow; row <= (lastMcu - 1) / mcusPerRow; row++) fReplaced = fReplaced || rowReplacements[row];
+
+			if (!fReplaced)
+			{
+				writer.PutBytes(&data[segmentStarts[segment]], segmentStarts[segment + 1] - segmentStarts[segment]);
+				continue;
+			}
+
+			BitReader reader(data, scanEnd, segmentStarts[segment]);
+			memset(preds, 0, sizeof(preds));
+			memset(srcPreds, 0, sizeof(srcPreds));
+
+			for (size_t mcu = firstMcu; mcu < lastMcu; mcu++)
+			{
+				if (!recodeMcu(reader, mcu)) return false;
+			}
+
+			writer.Flush();
+			if (segment + 1 < numSegments)
+			{
+				uint8_t marker[2] = { 0xFF, uint8_t(RST0 + segment % 8) };
+				writer.PutBytes(marker, 2);
+			}
+		}
+	}
+	else
+	{
+		for (int row = 0; row < numMcuRows;)
+		{
+			int lastRow = row + 1;
+			while (lastRow < numMcuRows && (rowReplacements[lastRow] != nullptr) == (rowReplacements[row] != nullptr)) lastRow++;
+
+			BitReader reader(data, scanEnd, rowPositions[row]);
+			memcpy(srcPreds, rowPositions[row].preds, sizeof(srcPreds));
+
+			if (rowReplacements[row])
+			{
+				for (size_t mcu = size_t(row) * mcusPerRow; mcu < size_t(lastRow) * mcusPerRow; mcu++)
+				{
+					if (!recodeMcu(reader, mcu)) return false;
+				}
+			}
+			else
+			{
+				//After the first MCU, the DC predictions are the same as in the file
+				if (!recodeMcu(reader, size_t(row) * mcusPerRow)) return false;
+
+				uint64_t numBits = rowPositions[lastRow].bitsRead - reader.BitsRead();
+				for (; numBits >= 16; numBits -= 16) writer.Put(uint32_t(reader.Get(16)), 16);
+				if (numBits > 0) writer.Put(uint32_t(reader.Get(int(numBits))), int(numBits));
+				memcpy(preds, rowPositions[lastRow].preds, sizeof(preds));
+			}
+
+			row = lastRow;
+		}
+
+		writer.Flush();
+	}
+
+	out.insert(out.end(), data.begin() + scanEnd, data.end());
+
+	FILE* file = fopen(filename.c_str(), "wb");
+	if (!file) return false;
+
+	bool fOk = fwrite(out.data(), 1, out.size(), file) == out.size();
+
+	//Write errors of the last buffer only show up here
+	if (fclose(file) != 0) fOk = false;
+	if (!fOk) remove(filename.c_str());
+	return fOk;
+}
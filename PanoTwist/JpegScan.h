@@ -0,0 +1,154 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+
+//Reads and writes the entropy-coded data of baseline JPEG files MCU by MCU
+//JpegLossless uses it to replace the MCU rows of the nadir and zenith patches in a file, while the coded data
+//of all the other rows is copied as it is: bit by bit, or byte by byte between restart markers
+#pragma once
+
+#include "BString.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+//Sampling and quantization of a JPEG image - what new blocks have to match to go into it
+struct JpegLayout
+{
+	enum { MaxComponents = 4 };
+
+	JpegLayout() : width(0), height(0), numComponents(0), maxH(1), maxV(1) {}
+
+	int width;
+	int height;
+	int numComponents;
+	int h[MaxComponents];					//Sampling factors of the components
+	int v[MaxComponents];
+	uint16_t quant[MaxComponents][64];		//Quantization table of each component, in natural order
+	int maxH;
+	int maxV;
+
+	int McuWidth() const { return maxH * 8; }
+	int McuHeight() const { return maxV * 8; }
+	int McusPerRow() const { return (width + McuWidth() - 1) / McuWidth(); }
+	int NumMcuRows() const { return (height + McuHeight() - 1) / McuHeight(); }
+};
+
+//DCT blocks of a range of MCU rows, 64 coefficients per block in natural order, same as libjpeg's JBLOCK
+//Includes the padding blocks that complete the MCUs at the right and bottom edges
+class McuRowBlocks
+{
+public:
+	McuRowBlocks() : firstMcuRow(0), numMcuRows(0), numComponents(0) {}
+
+	void Init(const JpegLayout& layout, int theFirstMcuRow, int theNumMcuRows);
+
+	int FirstMcuRow() const { return firstMcuRow; }
+	int LastMcuRow() const { return firstMcuRow + numMcuRows; }
+	int BlockRows(int c) const { return blockRows[c]; }
+	int BlockCols(int c) const { return blockCols[c]; }
+
+	//Rows are counted from FirstMcuRow()
+	short* Block(int c, int row, int col) { return &coefs[c][(size_t(row) * blockCols[c] + col) * 64]; }
+	const short* Block(int c, int row, int col) const { return &coefs[c][(size_t(row) * blockCols[c] + col) * 64]; }
+
+private:
+	int firstMcuRow;
+	int numMcuRows;
+	int numComponents;
+	int blockRows[JpegLayout::MaxComponents];
+	int blockCols[JpegLayout::MaxComponents];
+	std::vector<short> coefs[JpegLayout::MaxComponents];
+};
+
+class JpegScan
+{
+public:
+	JpegScan() : restartInterval(0), scanStart(0), scanEnd(0) {}
+	~JpegScan(){}
+
+	//Reads the file and locates the MCU rows in its coded data
+	//Returns false unless it is a baseline Huffman-coded YCbCr JPEG with a single scan
+	bool Open(const BString& filename);
+
+	const JpegLayout& Layout() const { return layout; }
+
+	//Decodes the MCU rows that blocks was initialized for
+	bool ReadMcuRows(McuRowBlocks& blocks) const;
+
+	//Writes the file with the MCU rows of the replacements instead of the original ones
+	//The APP1 segments of the file, with its EXIF and XMP, are replaced by app1Segments
+	//Returns false if the Huffman tables of the file have no code for some of the new coefficients
+	bool Write(const BString& filename, const std::vector<const McuRowBlocks*>& replacements,
+		const std::vector<std::string>& app1Segments) const;
+
+	//Contents of the APP1 segments that hold an EXIF block and an XMP packet, in that order, each after its identifier
+	//A block that is empty or too big for a segment is left out
+	static std::vector<std::string> App1Segments(const std::string& exifBlock, const std::string& xmpPacket);
+
+	//Canonical Huffman table from a DHT marker, with the lookup tables for decoding and encoding
+	struct HuffTable
+	{
+		HuffTable() : fDefined(false) {}
+		bool Build(const uint8_t* counts, const uint8_t* symbols, int numSymbols);
+
+		bool fDefined;
+		std::vector<uint8_t> values;
+		uint16_t lookup[512];			//(length << 8) | symbol for codes of up to 9 bits, 0 for longer codes
+		uint16_t skip[2048];			//Same for AC codes whose length and value bits add up to 11 bits at most
+		int32_t maxCode[18];			//Largest code of each length, -1 if none
+		int32_t valueOffset[17];		//Index in values of a code of each length, minus the smallest code of that length
+		uint16_t code[256];				//Code and its length for each symbol, length 0 if the symbol has no code
+		uint8_t codeLength[256];
+	};
+
+	//Where the decoder was at the start of an MCU row
+	struct Position
+	{
+		size_t pos;				//Next byte to read
+		uint64_t acc;			//Bits read ahead
+		int numBits;
+		uint64_t bitsRead;		//Bits consumed since the start of the scan, stuffed zero bytes not counted
+		int preds[JpegLayout::MaxComponents];
+	};
+
+private:
+	bool ParseHeaders();
+	bool FindRows();
+	void WriteHeaders(std::vector<uint8_t>& out, const std::vector<std::string>& app1Segments) const;	//Everything up to the coded data
+
+private:
+	std::vector<uint8_t> data;					//The whole file
+	JpegLayout layout;
+	int dcTable[JpegLayout::MaxComponents];		//Table numbers of the components in the scan
+	int acTable[JpegLayout::MaxComponents];
+	HuffTable dcTables[4];
+	HuffTable acTables[4];
+	int restartInterval;						//In MCUs, 0 - no restart markers
+
+	size_t scanStart;							//Coded data, after the SOS marker segment
+	size_t scanEnd;								//Marker that ends the scan
+
+	std::vector<Position> rowPositions;			//Without restart markers: start of each MCU row and the end
+	std::vector<size_t> segmentStarts;			//With restart markers: start of each restart interval, and scanEnd
+};
@@ -0,0 +1,158 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+
+#include "JpegStream.h"
+#include "JpegErrorManager.h"
+#include "JpegScan.h"
+
+#include <vector>
+
+namespace
+{
+	//Same as cv::imwrite
+	const int jpegQuality = 95;
+}
+
+//The strips are rescaled, shifted and patched by PanoProcessing::ProcessStrips()
+//libjpeg errors in its callbacks return false from the callback, the jump never leaves a callback
+bool JpegStream::ProcessFile(const BString& srcFilename, const BString& dstFilename, double rotationRad,
+	const RescaleSettings& rescale, const PatchSettings& nadir, const PatchSettings& zenith, cv::Size& size, bool& fTagged)
+{
+	size = cv::Size();
+	fTagged = false;
+
+	//cv::imread turns images with an EXIF orientation, the strips would come out unturned
+	ImageHeader header;
+	if (!PanoProcessing::ReadImageHeader(srcFilename, header, false) || header.orientation != 1) return false;
+
+	FILE* srcFile = fopen(srcFilename.c_str(), "rb");
+	if (!srcFile) return false;
+	FILE* dstFile = nullptr;
+
+	jpeg_decompress_struct srcInfo;
+	jpeg_compress_struct dstInfo;
+	JpegErrorManager err;
+	InitJpegErrorManager(err);
+	srcInfo.err = &err.pub;
+	dstInfo.err = &err.pub;
+	jpeg_create_decompress(&srcInfo);
+	jpeg_create_compress(&dstInfo);
+
+	//Everything with a destructor is declared before setjmp, longjmp skips destructors
+	std::vector<JSAMPROW> rowPointers;
+	cv::Mat rgbRows;
+	std::vector<std::string> app1Segments;
+
+	auto fail = [&]()
+	{
+		jpeg_destroy_compress(&dstInfo);
+		jpeg_destroy_decompress(&srcInfo);
+		fclose(srcFile);
+		if (dstFile)
+		{
+			fclose(dstFile);
+			remove(dstFilename.c_str());
+		}
+		return false;
+	};
+
+	if (setjmp(err.jump)) return fail();
+
+	jpeg_stdio_src(&srcInfo, srcFile);
+	jpeg_read_header(&srcInfo, TRUE);
+
+	//Same decoding as cv::imread for color files, CMYK files fail here
+	//The strips are color: grayscale files are left to PanoProcessing::ReadImage() unless they are too big for it
+	srcInfo.out_color_space = JCS_RGB;
+	jpeg_start_decompress(&srcInfo);
+
+	cv::Size srcSize(int(srcInfo.output_width), int(srcInfo.output_height));
+	if (!PanoProcessing::CanProcessInStrips(srcSize, rescale, nadir, zenith)) longjmp(err.jump, 1);
+	if (srcInfo.num_components != 3 && !PanoProcessing::IsTooBigToDecode(srcSize)) longjmp(err.jump, 1);
+
+	cv::Size outSize = PanoProcessing::RescaledSize(srcSize, rescale);
+	app1Segments = JpegScan::App1Segments(PanoProcessing::PanoramaExifBlock(outSize), PanoProcessing::PanoramaXmpPacket(outSize));
+
+	dstFile = fopen(dstFilename.c_str(), "wb");
+	if (!dstFile) longjmp(err.jump, 1);
+
+	dstInfo.image_width = JDIMENSION(outSize.width);
+	dstInfo.image_height = JDIMENSION(outSize.height);
+	dstInfo.input_components = 3;
+	dstInfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&dstInfo);
+	jpeg_set_quality(&dstInfo, jpegQuality, TRUE);
+	jpeg_stdio_dest(&dstInfo, dstFile);
+	jpeg_start_compress(&dstInfo, TRUE);
+	for (const std::string& segment : app1Segments) jpeg_write_marker(&dstInfo, JPEG_APP0 + 1, (const JOCTET*)segment.data(), unsigned(segment.size()));
+
+	auto readRows = [&](cv::Mat& rows)
+	{
+		if (setjmp(err.jump)) return false;
+
+		rowPointers.resize(rows.rows);
+		for (int i = 0; i < rows.rows; i++) rowPointers[i] = rows.ptr(i);
+		for (int i = 0; i < rows.rows;) i += int(jpeg_read_scanlines(&srcInfo, &rowPointers[i], JDIMENSION(rows.rows - i)));
+
+		cv::cvtColor(rows, rows, cv::COLOR_RGB2BGR);
+		return true;
+	};
+
+	auto writeRows = [&](const cv::Mat& rows)
+	{
+		cv::cvtColor(rows, rgbRows, cv::COLOR_BGR2RGB);
+
+		if (setjmp(err.jump)) return false;
+
+		for (int i = 0; i < rgbRows.rows; i++)
+		{
+			JSAMPROW row = rgbRows.ptr(i);
+			jpeg_write_scanlines(&dstInfo, &row, 1);
+		}
+		return true;
+	};
+
+	bool fDone = PanoProcessing::ProcessStrips(srcSize, readRows, writeRows, rotationRad, rescale, nadir, zenith);
+	if (!fDone) return fail();
+
+	//The callbacks have returned, errors go back to the cleanup above
+	if (setjmp(err.jump)) return fail();
+
+	jpeg_finish_compress(&dstInfo);
+	jpeg_finish_decompress(&srcInfo);
+
+	jpeg_destroy_compress(&dstInfo);
+	jpeg_destroy_decompress(&srcInfo);
+	fclose(srcFile);
+
+	//Write errors of the last buffer only show up here
+	if (fclose(dstFile) != 0)
+	{
+		remove(dstFilename.c_str());
+		return false;
+	}
+
+	size = outSize;
+	fTagged = app1Segments.size() == 2;
+	return true;
+}
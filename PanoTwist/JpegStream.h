@@ -0,0 +1,44 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+
+//Processing of JPEG panoramas in strips of rows, for images too big to decode into memory
+//The file is decoded a strip at a time, each strip is rescaled, shifted and patched, and encoded as soon as it is done,
+//so the memory needed grows with the width of the image but not with its height
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include "BString.h"
+#include "PanoProcessing.h"
+
+namespace JpegStream
+{
+	//Same result as cv::imread, PanoProcessing::Process() and cv::imwrite, without the whole image in memory
+	//size receives the size of the result; no metadata is copied, the EXIF size tags and GPano XMP of
+	//PanoProcessing::InsertExifTags() are written with the image, and fTagged receives whether they were
+	//Returns false if the file has to be decoded instead: it is not a JPEG, it has an EXIF orientation,
+	//its rescaling can't be done in strips, an average-filled patch overlaps the other one,
+	//or it is grayscale and can be decoded, which keeps it gray; nothing is written then
+	//Grayscale files too big to decode come out in color
+	bool ProcessFile(const BString& srcFilename, const BString& dstFilename, double rotationRad,
+		const RescaleSettings& rescale, const PatchSettings& nadir, const PatchSettings& zenith, cv::Size& size, bool& fTagged);
+}
@@ -37,6 +37,14 @@ MaxSizeWidget::MaxSizeWidget(QWidget *parent)
 	HandleEnabling();
 }
 
+RescaleSettings MaxSizeWidget::Settings()
+{
+	RescaleSettings settings;
+	settings.fEnabled = IsEnabled();
+	settings.maxHeight = MaxPermittedHeight();
+	return settings;
+}
+
 void MaxSizeWidget::HandleEnabling()
 {
 	bool fChecked = ui.checkEnabled->isChecked();
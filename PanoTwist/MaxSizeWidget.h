@@ -26,6 +26,8 @@
 #include <QWidget>
 #include "ui_MaxSizeWidget.h"
 
+#include "PanoProcessing.h"
+
 class MaxSizeWidget : public QWidget
 {
 	Q_OBJECT
@@ -38,6 +40,7 @@ public:
 	bool IsEnabled() { return ui.checkEnabled->isChecked(); }
 	int MaxPermittedWidth() { return ui.spinWidth->value(); }
 	int MaxPermittedHeight() { return ui.spinHeight->value(); }
+	RescaleSettings Settings();		//Current settings for use with PanoProcessing::Rescale()
 
 public slots :
 	void OnSpinWidthEditingFinished();
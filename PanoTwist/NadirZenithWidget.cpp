@@ -58,6 +58,23 @@ void NadirZenithWidget::SetColor(const BString& colorString)
 	else ui.editColor->setText(curColorString.c_str());
 };
 
+PatchSettings NadirZenithWidget::Settings()
+{
+	PatchSettings settings;
+	settings.fEnabled = IsEnabled();
+	settings.fNadir = IsNadir();
+	settings.angleDeg = AngleDeg();
+
+	if (IsFillColor()) settings.fillType = PatchSettings::FillColor;
+	else if (IsFillImage()) settings.fillType = PatchSettings::FillImage;
+	else settings.fillType = PatchSettings::FillAverage;
+
+	PanoProcessing::ParseColorString(ColorString(), settings.color);
+	if (IsPatchImageLoaded()) settings.patchImage = patchImage;
+
+	return settings;
+}
+
 void NadirZenithWidget::HandleEnabling()
 {
 	//Disable or enable everything depending on the state of the main check box
@@ -28,6 +28,7 @@
 
 #include "CvImageWidget.h"
 #include "BString.h"
+#include "PanoProcessing.h"
 
 class NadirZenithWidget : public QWidget
 {
@@ -72,6 +73,8 @@ public:
 
 	bool IsPatchImageLoaded() { return fPatchImageLoaded; }
 
+	PatchSettings Settings();		//Current settings for use with PanoProcessing::Patch()
+
 private:
 	void HandleEnabling();
 
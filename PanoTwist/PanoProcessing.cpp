@@ -0,0 +1,1211 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+#include "PanoProcessing.h"
+#include "ParallelLoop.h"
+#include "BilinearSampler.h"
+#include "BigTiff.h"
+
+#include <exiv2/exiv2.hpp>
+#include <mutex>
+#include <list>
+#include <cstdio>
+#include <climits>
+#include <cmath>
+
+#if CV_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	const double Pi = 3.1415926535897932;
+
+	//Lock function for Exiv2::XmpParser - the XMP toolkit is not thread-safe on its own
+	std::recursive_mutex xmpMutex;
+	void XmpLock(void* pLockData, bool fLock)
+	{
+		std::recursive_mutex* m = static_cast<std::recursive_mutex*>(pLockData);
+		if (fLock) m->lock();
+		else m->unlock();
+	}
+
+	//Everything the polar-to-equirectangular mapping of the image patch depends on
+	struct RemapKey
+	{
+		cv::Size patchSize;		//Size of the patch image
+		cv::Size bandSize;		//Size of the patched band of the panorama
+		bool fNadir;
+
+		bool operator==(const RemapKey& rhs) const
+		{
+			return patchSize == rhs.patchSize && bandSize == rhs.bandSize && fNadir == rhs.fNadir;
+		}
+	};
+
+	//Bilinear sampler taps, one for every pixel of the band
+	struct RemapTable
+	{
+		RemapKey key;
+		cv::Mat taps;		//BilinearSampler::Tap for each pixel
+	};
+
+	//Fills taps with the rows [firstRow, firstRow + taps.rows) of the table that maps every pixel of the band
+	//to a point of the circle inscribed into the patch image
+	//Polar row i is at the distance i/(rows-1)*radius from the center, column j at the angle j/cols*2Pi + Pi/2
+	//Polar rows run from the pole outwards, so the nadir band is flipped vertically
+	//The patch image must be at least 2x2
+	void BuildRemapTable(const RemapKey& key, int firstRow, cv::Mat& taps)
+	{
+		int rows = key.bandSize.height;
+		int cols = key.bandSize.width;
+
+		//The size of the patch image, in distances between pixels
+		int patchXsize = key.patchSize.width - 1;
+		int patchYsize = key.patchSize.height - 1;
+
+		double patchXcenter = double(patchXsize) / 2.;
+		double patchYcenter = double(patchYsize) / 2.;
+
+		//Radius of the circle from the patch image that we'll be using, in pixels
+		double radius = double(std::min(patchXsize, patchYsize)) / 2.;
+
+		//Direction constant depending on whether this is nadir or zenith
+		double dirConst = key.fNadir ? 1 : -1;
+
+		//The trigonometry only depends on the column
+		std::vector<double> cosPhi(cols), sinPhi(cols);
+		for (int j = 0; j < cols; j++)
+		{
+			double phi = double(j) / double(cols) * 2. * Pi + Pi / 2.;
+			cosPhi[j] = cos(phi);
+			sinPhi[j] = dirConst * sin(phi);
+		}
+
+		for (int k = 0; k < taps.rows; k++)
+		{
+			int i = key.fNadir ? rows - (firstRow + k) - 1 : firstRow + k;		//polar angle coordinate
+			double r = (rows > 1) ? double(i) / double(rows - 1) * radius : 0;
+
+			BilinearSampler::Tap* tapPtr = taps.ptr<BilinearSampler::Tap>(k);
+
+			//Rounded to float first, as the maps for cv::remap were, so the samples stay the same
+			for (int j = 0; j < cols; j++)			//azimuthal angle coordinate
+			{
+				tapPtr[j] = BilinearSampler::MakeTap(float(patchXcenter + r * cosPhi[j]), float(patchYcenter + r * sinPhi[j]), key.patchSize);
+			}
+		}
+	}
+
+	//Whole tables of preview-sized bands are cached, so that every preview refresh pays for the trigonometry only once
+	//Larger bands have only the rows being patched built, so the memory follows the rows, not the image;
+	//the taps take 8 bytes per pixel, a whole table would be 2 GB for the nadir of an 80000 x 40000 panorama
+	//The most recently used tables are kept at the front of the list
+	class RemapTableCache
+	{
+	public:
+		static const size_t maxBytes = size_t(64) << 20;		//All cached tables together
+
+		RemapTableCache() : numBytes(0) {}
+
+		static size_t TableBytes(const RemapKey& key)
+		{
+			return size_t(key.bandSize.width) * size_t(key.bandSize.height) * sizeof(BilinearSampler::Tap);
+		}
+
+		//Only for keys with TableBytes() up to maxBytes
+		RemapTable Get(const RemapKey& key)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			for (auto it = tables.begin(); it != tables.end(); ++it)
+			{
+				if (it->key == key)
+				{
+					tables.splice(tables.begin(), tables, it);
+					return tables.front();
+				}
+			}
+
+			RemapTable table;
+			table.key = key;
+			table.taps.create(key.bandSize, BilinearSampler::tapType);
+			BuildRemapTable(key, 0, table.taps);
+
+			tables.push_front(table);
+			numBytes += TableBytes(key);
+			while (numBytes > maxBytes)
+			{
+				numBytes -= TableBytes(tables.back().key);
+				tables.pop_back();
+			}
+
+			return table;	//cv::Mat copies share the data, so the table stays valid even if it is evicted
+		}
+
+	private:
+		std::mutex mutex;
+		std::list<RemapTable> tables;
+		size_t numBytes;
+	};
+
+	RemapTableCache remapTableCache;
+
+	//Strip heights for downsampling in Process()
+	const int minStripRows = 32;		//Strips are at least this tall, to keep cv::resize overhead low
+	const int maxStripRows = 512;		//Taller strips than this don't fit in the cache anyway
+
+	//Rows per strip in ProcessStrips(); the rescaled strips are a whole number of rescaling steps of at least this many rows
+	const int streamStripRows = 64;
+
+	int GreatestCommonDivisor(int a, int b)
+	{
+		while (b != 0)
+		{
+			int t = a % b;
+			a = b;
+			b = t;
+		}
+		return a;
+	}
+
+	//Height of the band that Patch() overwrites without looking at the pixels underneath
+	int OverwrittenRows(const PatchSettings& settings, int rows)
+	{
+		if (settings.fillType == PatchSettings::FillColor) return PanoProcessing::PatchHeight(settings, rows);
+		if (settings.fillType == PatchSettings::FillImage && !settings.patchImage.empty()) return PanoProcessing::PatchHeight(settings, rows);
+		return 0;
+	}
+
+	//Copies a row, cyclically shifted to the right
+	void CopyRowShifted(const uchar* src, uchar* dst, size_t rowBytes, size_t shiftBytes)
+	{
+		size_t restBytes = rowBytes - shiftBytes;
+		memcpy(dst + shiftBytes, src, restBytes);
+		memcpy(dst, src + restBytes, shiftBytes);
+	}
+
+	//Sums of the channels of the pixels with no zero channel in a row of 8-bit BGR pixels
+	void AddRowToAverage8u3(const uchar* row, int cols, uint64* channelSums, int64& numPixels)
+	{
+		int j = 0;
+
+#if CV_SSE2
+		//16 pixels, 48 bytes, at a time, without separating the channels: a pixel with a zero channel is cleared in place,
+		//then every channel is summed with _mm_sad_epu8 through a mask of the byte positions that hold it
+		//Byte k of the block belongs to channel k % 3, so the masks repeat every three registers
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i ones = _mm_set1_epi8(1);
+		const __m128i from0 = _mm_setr_epi8(-1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1);	//Bytes 0, 3, 6...
+		const __m128i from1 = _mm_setr_epi8(0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0);	//Bytes 1, 4, 7...
+		const __m128i from2 = _mm_setr_epi8(0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0);	//Bytes 2, 5, 8...
+		const __m128i channelMasks[3][3] =		//[register][channel]
+		{
+			{ from0, from1, from2 },
+			{ from2, from0, from1 },
+			{ from1, from2, from0 }
+		};
+
+		__m128i sums[3] = { zero, zero, zero };
+		__m128i counts = zero;
+
+		for (; j + 16 <= cols; j += 16)
+		{
+			const uchar* p = row + j * 3;
+			__m128i a = _mm_loadu_si128((const __m128i*)p);
+			__m128i b = _mm_loadu_si128((const __m128i*)(p + 16));
+			__m128i c = _mm_loadu_si128((const __m128i*)(p + 32));
+
+			__m128i za = _mm_cmpeq_epi8(a, zero);
+			__m128i zb = _mm_cmpeq_epi8(b, zero);
+			__m128i zc = _mm_cmpeq_epi8(c, zero);
+
+			//At the first byte of every pixel, whether one of its three bytes is zero
+			__m128i na = _mm_or_si128(_mm_or_si128(za, _mm_or_si128(_mm_srli_si128(za, 1), _mm_slli_si128(zb, 15))), _mm_or_si128(_mm_srli_si128(za, 2), _mm_slli_si128(zb, 14)));
+			__m128i nb = _mm_or_si128(_mm_or_si128(zb, _mm_or_si128(_mm_srli_si128(zb, 1), _mm_slli_si128(zc, 15))), _mm_or_si128(_mm_srli_si128(zb, 2), _mm_slli_si128(zc, 14)));
+			__m128i nc = _mm_or_si128(zc, _mm_or_si128(_mm_srli_si128(zc, 1), _mm_srli_si128(zc, 2)));
+			na = _mm_and_si128(na, channelMasks[0][0]);
+			nb = _mm_and_si128(nb, channelMasks[1][0]);
+			nc = _mm_and_si128(nc, channelMasks[2][0]);
+
+			//Spread to the other two bytes of the pixel
+			__m128i ma = _mm_or_si128(na, _mm_or_si128(_mm_slli_si128(na, 1), _mm_slli_si128(na, 2)));
+			__m128i mb = _mm_or_si128(_mm_or_si128(nb, _mm_or_si128(_mm_slli_si128(nb, 1), _mm_srli_si128(na, 15))), _mm_or_si128(_mm_slli_si128(nb, 2), _mm_srli_si128(na, 14)));
+			__m128i mc = _mm_or_si128(_mm_or_si128(nc, _mm_or_si128(_mm_slli_si128(nc, 1), _mm_srli_si128(nb, 15))), _mm_or_si128(_mm_slli_si128(nc, 2), _mm_srli_si128(nb, 14)));
+
+			a = _mm_andnot_si128(ma, a);
+			b = _mm_andnot_si128(mb, b);
+			c = _mm_andnot_si128(mc, c);
+
+			for (int k = 0; k < 3; k++)
+			{
+				__m128i sa = _mm_sad_epu8(_mm_and_si128(a, channelMasks[0][k]), zero);
+				__m128i sb = _mm_sad_epu8(_mm_and_si128(b, channelMasks[1][k]), zero);
+				__m128i sc = _mm_sad_epu8(_mm_and_si128(c, channelMasks[2][k]), zero);
+				sums[k] = _mm_add_epi64(sums[k], _mm_add_epi64(sa, _mm_add_epi64(sb, sc)));
+			}
+
+			//One at the first byte of every pixel that is kept
+			__m128i ka = _mm_andnot_si128(na, _mm_and_si128(channelMasks[0][0], ones));
+			__m128i kb = _mm_andnot_si128(nb, _mm_and_si128(channelMasks[1][0], ones));
+			__m128i kc = _mm_andnot_si128(nc, _mm_and_si128(channelMasks[2][0], ones));
+			counts = _mm_add_epi64(counts, _mm_sad_epu8(_mm_add_epi8(ka, _mm_add_epi8(kb, kc)), zero));
+		}
+
+		for (int k = 0; k < 3; k++)
+		{
+			uint64 lanes[2];
+			_mm_storeu_si128((__m128i*)lanes, sums[k]);
+			channelSums[k] += lanes[0] + lanes[1];
+		}
+
+		uint64 countLanes[2];
+		_mm_storeu_si128((__m128i*)countLanes, counts);
+		numPixels += int64(countLanes[0] + countLanes[1]);
+#endif
+
+		//Without branches, so that compilers can vectorize it where there are no intrinsics above
+		uint64 b = 0, g = 0, r = 0;
+		int64 n = 0;
+		for (; j < cols; j++)
+		{
+			const uchar* p = row + j * 3;
+			uint64 keep = uint64(p[0] != 0 && p[1] != 0 && p[2] != 0);
+			b += p[0] * keep;
+			g += p[1] * keep;
+			r += p[2] * keep;
+			n += int64(keep);
+		}
+
+		channelSums[0] += b;
+		channelSums[1] += g;
+		channelSums[2] += r;
+		numPixels += n;
+	}
+
+	//Integer images are summed in whole numbers, float ones in double
+	template<typename T> struct ChannelSum { typedef uint64 Type; };
+	template<> struct ChannelSum<float> { typedef double Type; };
+
+	void AddChannelSums(ColorSum& sum, const uint64* channelSums, int cn)
+	{
+		for (int k = 0; k < cn; k++) sum.channels[k] += channelSums[k];
+	}
+
+	void AddChannelSums(ColorSum& sum, const double* channelSums, int cn)
+	{
+		for (int k = 0; k < cn; k++) sum.floatChannels[k] += channelSums[k];
+	}
+
+	//Same sums for a row of any depth and number of channels, without branches like the tail of the 8-bit BGR kernel
+	template<typename T, int cn> void AddRowToAverage(const T* row, int cols, ColorSum& sum)
+	{
+		typedef typename ChannelSum<T>::Type SumType;
+		SumType channelSums[cn] = {};
+		int64 n = 0;
+
+		for (int j = 0; j < cols; j++, row += cn)
+		{
+			bool fKeep = true;
+			for (int c = 0; c < cn; c++) fKeep &= row[c] != 0;
+
+			for (int c = 0; c < cn; c++) channelSums[c] += row[c] * SumType(fKeep);
+			n += int64(fKeep);
+		}
+
+		AddChannelSums(sum, channelSums, cn);
+		sum.numPixels += n;
+	}
+
+	template<> void AddRowToAverage<uchar, 3>(const uchar* row, int cols, ColorSum& sum)
+	{
+		AddRowToAverage8u3(row, cols, sum.channels, sum.numPixels);
+	}
+
+	template<typename T, int cn> void AddRowsToAverage(const cv::Mat& rows, ColorSum& sum)
+	{
+		for (int i = 0; i < rows.rows; i++) AddRowToAverage<T, cn>(rows.ptr<T>(i), rows.cols, sum);
+	}
+
+	//The value of white in the supported depths; float images are white at 1, HDR ones go above it
+	double WhiteValue(int depth)
+	{
+		if (depth == CV_8U) return 255.;
+		if (depth == CV_16U) return 65535.;
+		return 1.;
+	}
+
+	//The 8-bit BGR fill color in the units of an image of the given type
+	cv::Scalar FillValue(const cv::Vec3b& bgr, int type)
+	{
+		cv::Mat pixel(1, 1, CV_8UC3, cv::Scalar(bgr(0), bgr(1), bgr(2)));
+
+		cv::Mat value;
+		PanoProcessing::ConvertToType(pixel, type).convertTo(value, CV_64F);
+
+		cv::Scalar fill;
+		for (int k = 0; k < value.channels(); k++) fill[k] = value.ptr<double>()[k];
+		return fill;
+	}
+
+	//Deepest depth that the format of the extension can store an image of the given depth in
+	//cv::imencode writes 8 bits except for PNG, TIFF, JPEG 2000 and PNM, which take 16; the HDR formats get float in any case
+	int EncodedDepth(BString extension, int depth)
+	{
+		extension.MakeLower();
+		if (extension == ".hdr" || extension == ".pic" || extension == ".exr") return CV_32F;
+		if (depth == CV_8U) return CV_8U;
+
+		bool f16Bit = extension == ".png" || extension == ".tif" || extension == ".tiff" || extension == ".jp2" ||
+			extension == ".pgm" || extension == ".ppm" || extension == ".pnm";
+		return f16Bit ? CV_16U : CV_8U;
+	}
+
+	//A patch band in the result of ProcessStrips(), [firstRow, lastRow)
+	//Average-filled bands can only be written once all of their rows have been summed
+	struct Band
+	{
+		Band(const PatchSettings& theSettings, int rows) : settings(theSettings)
+		{
+			int bandRows = PanoProcessing::PatchHeight(settings, rows);
+			firstRow = settings.fNadir ? rows - bandRows : 0;
+			lastRow = firstRow + bandRows;
+			fAverage = bandRows > 0 && settings.fillType == PatchSettings::FillAverage;
+		}
+
+		bool Contains(int row) const { return row >= firstRow && row < lastRow; }
+
+		//Sums or fills the rows of the strip that starts at stripFirstRow
+		void Patch(cv::Mat& strip, int stripFirstRow)
+		{
+			int first = std::max(firstRow, stripFirstRow);
+			int last = std::min(lastRow, stripFirstRow + strip.rows);
+			if (first >= last) return;
+
+			cv::Mat rows(strip, cv::Range(first - stripFirstRow, last - stripFirstRow), cv::Range::all());
+			if (fAverage) PanoProcessing::AddToAverage(rows, sum);
+			else PanoProcessing::PatchBandRows(rows, settings, lastRow - firstRow, first - firstRow);
+		}
+
+		const PatchSettings& settings;
+		int firstRow;
+		int lastRow;
+		bool fAverage;
+		ColorSum sum;
+	};
+
+	//The GPano tags of an uncropped equirectangular panorama
+	//viewRotationRad turns the initial view the way Rotate() would turn the pixels
+	void SetPanoramaXmp(Exiv2::XmpData& xmpData, cv::Size imageSize, double viewRotationRad)
+	{
+		xmpData["Xmp.GPano.ProjectionType"] = Exiv2::XmpTextValue("equirectangular");
+		xmpData["Xmp.GPano.UsePanoramaViewer"] = true;
+
+		//Cropping - not cropped
+		xmpData["Xmp.GPano.CroppedAreaLeftPixels"] = int32_t(0);
+		xmpData["Xmp.GPano.CroppedAreaTopPixels"] = int32_t(0);
+
+		xmpData["Xmp.GPano.CroppedAreaImageWidthPixels"] = int32_t(imageSize.width);
+		xmpData["Xmp.GPano.CroppedAreaImageHeightPixels"] = int32_t(imageSize.height);
+
+		xmpData["Xmp.GPano.FullPanoWidthPixels"] = int32_t(imageSize.width);
+		xmpData["Xmp.GPano.FullPanoHeightPixels"] = int32_t(imageSize.height);
+
+		//Pose of the center of the images relative to the true north
+		//Kept at 0, so that headings relative to the north and to the center of the image are the same for every viewer
+		xmpData["Xmp.GPano.PoseHeadingDegrees"] = 0.0;
+		xmpData["Xmp.GPano.PosePitchDegrees"] = 0.0;
+		xmpData["Xmp.GPano.PoseRollDegrees"] = 0.0;
+
+		//Initial view position
+		//Rotate() moves column j to j + shift, so the view starts on the column that it would bring to the center;
+		//headings grow to the right and the tag is a whole number of degrees in [0, 360)
+		int heading = int(std::lround(-viewRotationRad * 180. / Pi)) % 360;
+		if (heading < 0) heading += 360;
+
+		xmpData["Xmp.GPano.InitialViewHeadingDegrees"] = int32_t(heading);
+		xmpData["Xmp.GPano.InitialViewPitchDegrees"] = int32_t(0);
+		xmpData["Xmp.GPano.InitialViewRollDegrees"] = int32_t(0);
+	}
+
+	//The EXIF size tags that go with the GPano tags
+	void SetPanoramaExif(Exiv2::ExifData& exifData, cv::Size imageSize)
+	{
+		exifData["Exif.Image.ImageWidth"] = int32_t(imageSize.width);
+		exifData["Exif.Image.ImageLength"] = int32_t(imageSize.height);
+	}
+
+	//Sets the panorama tags on top of the EXIF and XMP the image already has; throws Exiv2::AnyError on failure
+	//Freshly encoded images have none of their own, files copied without decoding keep their camera, GPS and XMP tags
+	void WritePanoramaTags(Exiv2::Image& image, cv::Size imageSize, double viewRotationRad)
+	{
+		image.readMetadata();
+
+		SetPanoramaExif(image.exifData(), imageSize);
+		SetPanoramaXmp(image.xmpData(), imageSize, viewRotationRad);
+		image.writeMetadata();
+	}
+}
+
+//Rescale the image if rescaling is enabled
+//And image size is greater than allowed
+void PanoProcessing::Rescale(cv::Mat& image, const RescaleSettings& settings)
+{
+	if (!settings.fEnabled) return;
+
+	int maxHeight = settings.maxHeight;
+	if (maxHeight <= 0 || maxHeight >= image.rows) return;
+
+	//Yes, the image is bigger than allowed - rescale it down
+	cv::resize(image, image, cv::Size(maxHeight * 2, maxHeight), 0, 0, cv::INTER_AREA);
+}
+
+//Rotate the image in the azimuth angle
+void PanoProcessing::Rotate(cv::Mat& image, double rotationRad)
+{
+	HorizontalCyclicRotate(image, RotationPixels(image.cols, rotationRad));
+}
+
+//Horizontal shift for the rotation angle, in pixels
+int PanoProcessing::RotationPixels(int cols, double rotationRad)
+{
+	double rotAngle = fmod(rotationRad, 2*Pi);
+	return int(double(cols) * rotAngle / (2*Pi));
+}
+
+//Same test as in Rescale()
+cv::Size PanoProcessing::RescaledSize(cv::Size size, const RescaleSettings& settings)
+{
+	if (!settings.fEnabled || settings.maxHeight <= 0 || settings.maxHeight >= size.height) return size;
+	return cv::Size(settings.maxHeight * 2, settings.maxHeight);
+}
+
+//Height of the band patched by the settings in an image with the given number of rows
+int PanoProcessing::PatchHeight(const PatchSettings& settings, int rows)
+{
+	if (!settings.fEnabled) return 0;
+	return int(double(rows) * settings.angleDeg / 180.0 / 2);
+}
+
+//Patch nadir or zenith according to the settings
+void PanoProcessing::Patch(cv::Mat& image, const PatchSettings& settings)
+{
+	if (!settings.fEnabled) return;
+
+	int xSize = image.cols;
+	int ySize = image.rows;
+
+	//The height of the patch in equirectangular projection
+	int nzHeight = PatchHeight(settings, ySize);
+
+	if (nzHeight == 0) return;
+
+	//The location of the patch - either at the top or bottom
+	int yStartPoint;
+	if (settings.fNadir) yStartPoint = ySize - nzHeight;
+	else yStartPoint = 0;
+	
+	cv::Mat dest(image, cv::Rect(0, yStartPoint, xSize, nzHeight));
+	PatchBand(dest, settings);
+}
+
+//Fill the band that was cut out of the image by Patch()
+//The band is split into tiles of rows, which are summed and filled on the thread pool
+//For 8 and 16-bit images the sums are whole numbers, so adding up the tiles in any order gives the same average
+void PanoProcessing::PatchBand(cv::Mat& dest, const PatchSettings& settings)
+{
+	if (!settings.fEnabled || dest.empty()) return;
+
+	if (settings.fillType == PatchSettings::FillAverage)			//Filled by average color
+	{
+		ColorSum sum;
+		std::mutex sumMutex;
+
+		ParallelLoop::Run(cv::Range(0, dest.rows), [&](const cv::Range& range)
+		{
+			ColorSum tileSum;
+			AddToAverage(dest.rowRange(range), tileSum);
+
+			std::lock_guard<std::mutex> lock(sumMutex);
+			sum += tileSum;
+		});
+
+		cv::Scalar color = AverageColor(sum);
+		ParallelLoop::Run(cv::Range(0, dest.rows), [&](const cv::Range& range) { dest.rowRange(range).setTo(color); });
+	}
+	else
+	{
+		//The patch image is converted to the type of the band once, not in every tile
+		PatchSettings bandSettings = settings;
+		bandSettings.patchImage = ConvertToType(settings.patchImage, dest.type());
+
+		ParallelLoop::Run(cv::Range(0, dest.rows), [&](const cv::Range& range)
+		{
+			cv::Mat rows = dest.rowRange(range);
+			PatchBandRows(rows, bandSettings, dest.rows, range.start);
+		});
+	}
+}
+
+//The color and image fills don't depend on the pixels underneath, so any rows of the band can be filled on their own
+void PanoProcessing::PatchBandRows(cv::Mat& dest, const PatchSettings& settings, int bandRows, int firstBandRow)
+{
+	if (!settings.fEnabled || dest.empty()) return;
+
+	if (settings.fillType == PatchSettings::FillColor)		//Filled by specified color
+	{
+		dest.setTo(FillValue(settings.color, dest.type()));
+	}
+
+	else if (settings.fillType == PatchSettings::FillImage && !settings.patchImage.empty())		//Filled by image
+	{
+		//The sampler reads whole 2x2 neighbourhoods from a continuous image of the type of the band
+		//A patch of a single row or column is stretched to two, the smallest it can sample
+		cv::Mat patch = ConvertToType(settings.patchImage, dest.type());
+		if (patch.cols < 2 || patch.rows < 2) cv::resize(patch, patch, cv::Size(std::max(patch.cols, 2), std::max(patch.rows, 2)), 0, 0, cv::INTER_NEAREST);
+		else if (!patch.isContinuous()) patch = patch.clone();
+
+		RemapKey key;
+		key.patchSize = patch.size();
+		key.bandSize = cv::Size(dest.cols, bandRows);
+		key.fNadir = settings.fNadir;
+
+		//Bilinear interpolation from the patch image through the fixed-point table, cached or built for these rows
+		cv::Mat taps;
+		if (RemapTableCache::TableBytes(key) <= RemapTableCache::maxBytes)
+		{
+			taps = remapTableCache.Get(key).taps.rowRange(firstBandRow, firstBandRow + dest.rows);
+		}
+		else
+		{
+			taps.create(dest.size(), BilinearSampler::tapType);
+			BuildRemapTable(key, firstBandRow, taps);
+		}
+
+		BilinearSampler::Sample(patch, taps, dest);
+	}
+}
+
+//Sum of all pixel values, excluding black pixels - those with any channel at 0
+//Row by row, so the band may be a part of a larger image; the kernel for the type is chosen once for all rows
+void PanoProcessing::AddToAverage(const cv::Mat& rows, ColorSum& sum)
+{
+	switch (rows.type())
+	{
+	case CV_8UC1:	AddRowsToAverage<uchar, 1>(rows, sum);	break;
+	case CV_8UC3:	AddRowsToAverage<uchar, 3>(rows, sum);	break;
+	case CV_16UC1:	AddRowsToAverage<ushort, 1>(rows, sum);	break;
+	case CV_16UC3:	AddRowsToAverage<ushort, 3>(rows, sum);	break;
+	case CV_32FC1:	AddRowsToAverage<float, 1>(rows, sum);	break;
+	case CV_32FC3:	AddRowsToAverage<float, 3>(rows, sum);	break;
+	}
+}
+
+//Rounded down for 8 and 16-bit images, as the division of the floating-point sums was before
+cv::Scalar PanoProcessing::AverageColor(const ColorSum& sum)
+{
+	cv::Scalar color;
+	if (sum.numPixels == 0) return color;
+
+	uint64 num = uint64(sum.numPixels);
+	for (int k = 0; k < 3; k++) color[k] = double(sum.channels[k] / num) + sum.floatChannels[k] / double(num);
+	return color;
+}
+
+//Rescale, rotate and patch in one pass over the image
+//Rows are read from src once and written to the result once; the bands that Patch() fills with
+//a color or an image are not computed from src at all, and the average-filled bands are the only rows read twice
+void PanoProcessing::Process(const cv::Mat& src, cv::Mat& dst, double rotationRad, const RescaleSettings& rescale,
+							 const PatchSettings& nadir, const PatchSettings& zenith)
+{
+	if (src.empty())
+	{
+		dst = cv::Mat();
+		return;
+	}
+
+	//The size Rescale() would produce
+	cv::Size outSize = RescaledSize(src.size(), rescale);
+
+	//Not written into dst directly, so that src and dst may be the same image
+	cv::Mat result(outSize, src.type());
+
+	//Only rows [firstRow, lastRow) need the panorama
+	//Nadir is patched first, so an average-filled nadir band still needs the rows the zenith patch overwrites later
+	int firstRow = OverwrittenRows(zenith, outSize.height);
+	int lastRow = outSize.height - OverwrittenRows(nadir, outSize.height);
+	if (nadir.fEnabled && nadir.fillType == PatchSettings::FillAverage) firstRow = std::min(firstRow, outSize.height - PatchHeight(nadir, outSize.height));
+
+	int shift = RotationPixels(outSize.width, rotationRad) % outSize.width;
+	if (shift < 0) shift += outSize.width;
+
+	size_t rowBytes = outSize.width * result.elemSize();
+	size_t shiftBytes = shift * result.elemSize();
+
+	//Copies the needed rows of an image of the output size into the result
+	auto copyShifted = [&](const cv::Mat& image)
+	{
+		ParallelLoop::Run(cv::Range(firstRow, lastRow), [&](const cv::Range& range)
+		{
+			for (int i = range.start; i < range.end; i++) CopyRowShifted(image.ptr(i), result.ptr(i), rowBytes, shiftBytes);
+		});
+	};
+
+	//INTER_AREA downsampling of a horizontal strip gives exactly the rows of the full-size resize
+	//as long as the strip starts and ends on whole source rows, which is the case for multiples of outStep rows
+	int divisor = GreatestCommonDivisor(src.rows, outSize.height);
+	int srcStep = src.rows / divisor;
+	int outStep = outSize.height / divisor;
+
+	if (firstRow >= lastRow)
+	{
+		//Everything is patched over
+	}
+	else if (outSize == src.size())
+	{
+		copyShifted(src);
+	}
+	else if (outStep > maxStripRows)
+	{
+		//The strips would have to be too tall - downsample the whole image first
+		cv::Mat scaled;
+		cv::resize(src, scaled, outSize, 0, 0, cv::INTER_AREA);
+		copyShifted(scaled);
+	}
+	else
+	{
+		int stripRows = outStep * std::max(1, (minStripRows + outStep - 1) / outStep);
+		int firstStrip = firstRow / stripRows;
+		int lastStrip = (lastRow + stripRows - 1) / stripRows;
+
+		ParallelLoop::Run(cv::Range(firstStrip, lastStrip), [&](const cv::Range& range)
+		{
+			cv::Mat strip;		//Reused by all strips of this worker
+
+			for (int s = range.start; s < range.end; s++)
+			{
+				int outStart = s * stripRows;
+				int outEnd = std::min(outStart + stripRows, outSize.height);
+
+				cv::Mat srcStrip(src, cv::Range(outStart / outStep * srcStep, outEnd / outStep * srcStep), cv::Range::all());
+				cv::resize(srcStrip, strip, cv::Size(outSize.width, outEnd - outStart), 0, 0, cv::INTER_AREA);
+
+				int rowStart = std::max(outStart, firstRow);
+				int rowEnd = std::min(outEnd, lastRow);
+				for (int i = rowStart; i < rowEnd; i++) CopyRowShifted(strip.ptr(i - outStart), result.ptr(i), rowBytes, shiftBytes);
+			}
+		});
+	}
+
+	Patch(result, nadir);
+	Patch(result, zenith);
+
+	dst = result;
+}
+
+//Only reads the settings, and the remap table cache is locked, so workers may share one settings object
+void PanoProcessing::Process(const cv::Mat& src, cv::Mat& dst, const ProcessingSettings& settings)
+{
+	Process(src, dst, settings.rotationRad, settings.rescale, settings.nadir, settings.zenith);
+}
+
+//Strips are a whole number of INTER_AREA steps, as in Process()
+//The result is written row by row in order, so the rows of an average-filled band wait until the band has been summed:
+//the zenith band until its last row is read, the nadir band until the end. They are all of one color, so only
+//the sum is kept, not the rows. If the zenith band is averaged and overlaps the nadir band, its sum would include
+//the nadir fill, so such images are left to Process()
+bool PanoProcessing::CanProcessInStrips(cv::Size srcSize, const RescaleSettings& rescale, const PatchSettings& nadir, const PatchSettings& zenith)
+{
+	if (srcSize.width <= 0 || srcSize.height <= 0) return false;
+
+	cv::Size outSize = RescaledSize(srcSize, rescale);
+	int outStep = outSize.height / GreatestCommonDivisor(srcSize.height, outSize.height);
+
+	Band nadirBand(nadir, outSize.height);
+	Band zenithBand(zenith, outSize.height);
+
+	return outStep <= maxStripRows && !(zenithBand.fAverage && zenithBand.lastRow > nadirBand.firstRow);
+}
+
+bool PanoProcessing::ProcessStrips(cv::Size srcSize, const ReadRowsFunction& readRows, const WriteRowsFunction& writeRows,
+								   double rotationRad, const RescaleSettings& rescale, const PatchSettings& nadir, const PatchSettings& zenith)
+{
+	if (!CanProcessInStrips(srcSize, rescale, nadir, zenith)) return false;
+
+	cv::Size outSize = RescaledSize(srcSize, rescale);
+
+	int divisor = GreatestCommonDivisor(srcSize.height, outSize.height);
+	int srcStep = srcSize.height / divisor;
+	int outStep = outSize.height / divisor;
+	int outStripRows = outStep * std::max(1, (streamStripRows + outStep - 1) / outStep);
+
+	Band nadirBand(nadir, outSize.height);
+	Band zenithBand(zenith, outSize.height);
+
+	//Rows that wait for the average of their band
+	auto isWaiting = [&](int row)
+	{
+		if (zenithBand.fAverage && zenithBand.Contains(row)) return true;
+		return nadirBand.fAverage && nadirBand.Contains(row) && !zenithBand.Contains(row);
+	};
+
+	//Writes rows of one color, a strip at a time
+	auto writeColorRows = [&](const cv::Scalar& color, int numRows)
+	{
+		cv::Mat rows(std::max(1, std::min(numRows, outStripRows)), outSize.width, CV_8UC3, color);
+		for (int i = 0; i < numRows; i += rows.rows)
+		{
+			if (!writeRows(rows.rowRange(0, std::min(rows.rows, numRows - i)))) return false;
+		}
+		return true;
+	};
+
+	int shift = RotationPixels(outSize.width, rotationRad) % outSize.width;
+	if (shift < 0) shift += outSize.width;
+
+	size_t rowBytes = size_t(outSize.width) * 3;
+	size_t shiftBytes = size_t(shift) * 3;
+
+	cv::Mat srcStrip, scaledStrip, strip;
+
+	for (int outStart = 0; outStart < outSize.height; outStart += outStripRows)
+	{
+		int outEnd = std::min(outStart + outStripRows, outSize.height);
+		int srcRows = (outEnd / outStep - outStart / outStep) * srcStep;
+
+		srcStrip.create(srcRows, srcSize.width, CV_8UC3);
+		if (!readRows(srcStrip)) return false;
+
+		if (outSize == srcSize) scaledStrip = srcStrip;
+		else cv::resize(srcStrip, scaledStrip, cv::Size(outSize.width, outEnd - outStart), 0, 0, cv::INTER_AREA);
+
+		strip.create(scaledStrip.size(), CV_8UC3);
+		for (int i = 0; i < strip.rows; i++) CopyRowShifted(scaledStrip.ptr(i), strip.ptr(i), rowBytes, shiftBytes);
+
+		//Nadir first, as in Process()
+		nadirBand.Patch(strip, outStart);
+		zenithBand.Patch(strip, outStart);
+
+		//The zenith band is summed once its last row is in
+		if (zenithBand.fAverage && outStart < zenithBand.lastRow && outEnd >= zenithBand.lastRow)
+		{
+			if (!writeColorRows(AverageColor(zenithBand.sum), zenithBand.lastRow)) return false;
+		}
+
+		//Runs of rows that are ready
+		for (int i = outStart; i < outEnd;)
+		{
+			if (isWaiting(i))
+			{
+				i++;
+				continue;
+			}
+
+			int end = i + 1;
+			while (end < outEnd && !isWaiting(end)) end++;
+
+			if (!writeRows(strip.rowRange(i - outStart, end - outStart))) return false;
+			i = end;
+		}
+	}
+
+	//The rows of the nadir band that the zenith band does not cover
+	if (nadirBand.fAverage)
+	{
+		int firstRow = std::max(nadirBand.firstRow, zenithBand.lastRow);
+		if (!writeColorRows(AverageColor(nadirBand.sum), nadirBand.lastRow - firstRow)) return false;
+	}
+
+	return true;
+}
+
+//Performs horizontal right cyclical shift of the matrix
+//Works in place, row by row: the shorter of the two parts of the row is saved to a scratch buffer,
+//the longer part is moved with memmove, and the scratch is copied back
+//So the only extra memory is one partial row per worker thread, and every pixel is moved once
+void PanoProcessing::HorizontalCyclicRotate(cv::Mat& mat, int numPixels)
+{
+	if (mat.empty()) return;
+
+	//Shift the value of numPixels into the interval [0,mat.cols) as needed
+	numPixels = numPixels % mat.cols;
+	if (numPixels < 0) numPixels += mat.cols;
+
+	if (numPixels == 0) return;
+
+	size_t pixelSize = mat.elemSize();
+	size_t rowBytes = mat.cols * pixelSize;
+	size_t shiftBytes = numPixels * pixelSize;			//The right part that wraps around to the left
+	size_t restBytes = rowBytes - shiftBytes;			//The left part that moves to the right
+	size_t scratchBytes = std::min(shiftBytes, restBytes);
+
+	ParallelLoop::Run(cv::Range(0, mat.rows), [&](const cv::Range& range)
+	{
+		std::vector<uchar> buffer(scratchBytes);
+		uchar* scratch = buffer.data();
+
+		for (int i = range.start; i < range.end; i++)
+		{
+			uchar* row = mat.ptr(i);
+
+			if (shiftBytes <= restBytes)
+			{
+				memcpy(scratch, row + restBytes, shiftBytes);
+				memmove(row + shiftBytes, row, restBytes);
+				memcpy(row, scratch, shiftBytes);
+			}
+			else
+			{
+				memcpy(scratch, row, restBytes);
+				memmove(row, row + restBytes, shiftBytes);
+				memcpy(row + shiftBytes, scratch, restBytes);
+			}
+		}
+	});
+}
+
+//Exiv2 rewrites the file in its memory buffer, which is then copied back
+//fileData is left as it was if Exiv2 fails
+bool PanoProcessing::InsertExifTags(std::vector<uchar>& fileData, const cv::Mat& image)
+{
+	return InsertExifTagsForSize(fileData, image.size(), 0);
+}
+
+bool PanoProcessing::InsertExifTagsForSize(std::vector<uchar>& fileData, cv::Size imageSize, double viewRotationRad)
+{
+	//Exiv2 sizes memory buffers with a long, which has 32 bits on Windows
+	if (fileData.empty() || fileData.size() > size_t(LONG_MAX)) return false;
+
+	try
+	{
+		Exiv2::Image::AutoPtr imageFile = Exiv2::ImageFactory::open(fileData.data(), long(fileData.size()));
+		if (!imageFile.get()) return false;
+
+		WritePanoramaTags(*imageFile, imageSize, viewRotationRad);
+
+		Exiv2::BasicIo& io = imageFile->io();
+		if (io.open() != 0) return false;
+
+		//Copied out before replacing fileData, which the buffer could still point into
+		const Exiv2::byte* data = io.mmap();
+		std::vector<uchar> taggedData(data, data + io.size());
+		io.munmap();
+		io.close();
+
+		fileData.swap(taggedData);
+	}
+	catch (Exiv2::AnyError&)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+//The format comes from the extension, as in cv::imwrite
+bool PanoProcessing::EncodeImage(const BString& filename, const cv::Mat& image, std::vector<uchar>& fileData)
+{
+	size_t dot = filename.find_last_of('.');
+	if (dot == std::string::npos || image.empty()) return false;
+
+	BString extension = filename.substr(dot);
+	int depth = EncodedDepth(extension, image.depth());
+
+	try
+	{
+		return cv::imencode(extension, ConvertToType(image, CV_MAKETYPE(depth, image.channels())), fileData);
+	}
+	catch (cv::Exception&)
+	{
+		return false;
+	}
+}
+
+//Read in chunks until the end, the size is not asked for because ftell() is limited to 2 GB on Windows
+bool PanoProcessing::ReadFileData(const BString& filename, std::vector<uchar>& fileData)
+{
+	FILE* file = fopen(filename.c_str(), "rb");
+	if (!file) return false;
+
+	const size_t chunkBytes = 1 << 20;
+	fileData.clear();
+
+	size_t numRead;
+	do
+	{
+		size_t oldSize = fileData.size();
+		fileData.resize(oldSize + chunkBytes);
+		numRead = fread(fileData.data() + oldSize, 1, chunkBytes, file);
+		fileData.resize(oldSize + numRead);
+	} while (numRead == chunkBytes);
+
+	bool fRead = !ferror(file);
+	fclose(file);
+	return fRead;
+}
+
+bool PanoProcessing::WriteFileData(const BString& filename, const std::vector<uchar>& fileData)
+{
+	FILE* file = fopen(filename.c_str(), "wb");
+	if (!file) return false;
+
+	bool fWritten = fwrite(fileData.data(), 1, fileData.size(), file) == fileData.size();
+
+	//Write errors of the last buffer only show up in fclose
+	if (fclose(file) != 0 || !fWritten)
+	{
+		remove(filename.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+//The image data is copied as it is, only the metadata segments are rewritten; the other tags of the file are kept
+//Turned images are refused: decoded, they are saved upright without the EXIF orientation, a copy would not be
+//With fVirtualRotation, the rotation only turns the initial view in the tags and the pixels stay where they are
+bool PanoProcessing::CopyWithExifTags(const BString& inFile, const BString& outFile, double rotationRad, bool fVirtualRotation,
+	const RescaleSettings& rescale, const PatchSettings& nadir, const PatchSettings& zenith, cv::Size& size)
+{
+	ImageHeader header;
+	if (!ReadImageHeader(inFile, header, false) || header.width == 0 || header.height == 0 || header.orientation != 1) return false;
+
+	//The whole file is held in memory, the strip writers handle the huge ones
+	size = cv::Size(header.width, header.height);
+	double pixelRotationRad = fVirtualRotation ? 0 : rotationRad;
+	if (IsTooBigToDecode(size) || ChangesPixels(size, pixelRotationRad, rescale, nadir, zenith)) return false;
+
+	double viewRotationRad = fVirtualRotation ? rotationRad : 0;
+	std::vector<uchar> fileData;
+	return ReadFileData(inFile, fileData) && InsertExifTagsForSize(fileData, size, viewRotationRad) && WriteFileData(outFile, fileData);
+}
+
+bool PanoProcessing::ChangesPixels(cv::Size size, double rotationRad, const RescaleSettings& rescale,
+	const PatchSettings& nadir, const PatchSettings& zenith)
+{
+	return RotationPixels(size.width, rotationRad) != 0 || RescaledSize(size, rescale) != size ||
+		PatchHeight(nadir, size.height) > 0 || PatchHeight(zenith, size.height) > 0;
+}
+
+//The file is written even if the tags can't be inserted, as it was when they were inserted into the written file
+bool PanoProcessing::WriteWithExifTags(const BString& filename, const cv::Mat& image, bool& fTagged)
+{
+	std::vector<uchar> fileData;
+	if (!EncodeImage(filename, image, fileData)) return false;
+
+	fTagged = InsertExifTags(fileData, image);
+	return WriteFileData(filename, fileData);
+}
+
+std::string PanoProcessing::PanoramaXmpPacket(cv::Size imageSize)
+{
+	Exiv2::XmpData xmpData;
+	SetPanoramaXmp(xmpData, imageSize, 0);
+
+	std::string xmpPacket;
+	try
+	{
+		if (Exiv2::XmpParser::encode(xmpPacket, xmpData) != 0) return std::string();
+	}
+	catch (Exiv2::AnyError&)
+	{
+		return std::string();
+	}
+
+	return xmpPacket;
+}
+
+std::string PanoProcessing::PanoramaExifBlock(cv::Size imageSize)
+{
+	Exiv2::ExifData exifData;
+	SetPanoramaExif(exifData, imageSize);
+
+	Exiv2::Blob blob;
+	try
+	{
+		Exiv2::ExifParser::encode(blob, Exiv2::littleEndian, exifData);
+	}
+	catch (Exiv2::AnyError&)
+	{
+		return std::string();
+	}
+
+	return std::string(blob.begin(), blob.end());
+}
+
+void PanoProcessing::InitializeMetadataThreading()
+{
+	Exiv2::XmpParser::initialize(XmpLock, &xmpMutex);
+}
+
+//Alpha is dropped, as cv::imread does for color images
+cv::Mat PanoProcessing::ReadImage(const BString& filename)
+{
+	cv::Mat mat = cv::imread(filename, cv::IMREAD_ANYDEPTH | cv::IMREAD_ANYCOLOR);
+	if (mat.empty() || IsSupportedType(mat.type())) return mat;
+
+	cv::Mat converted;
+	mat.convertTo(converted, CV_MAKETYPE(CV_32F, mat.channels()));
+	return converted;
+}
+
+bool PanoProcessing::IsSupportedType(int type)
+{
+	int depth = CV_MAT_DEPTH(type);
+	int cn = CV_MAT_CN(type);
+	return (depth == CV_8U || depth == CV_16U || depth == CV_32F) && (cn == 1 || cn == 3);
+}
+
+//The range is scaled from white to white, with saturation; cv::cvtColor turns color into gray and gray into color
+cv::Mat PanoProcessing::ConvertToType(const cv::Mat& image, int type)
+{
+	if (image.empty() || image.type() == type) return image;
+
+	int depth = CV_MAT_DEPTH(type);
+	int cn = CV_MAT_CN(type);
+
+	cv::Mat scaled = image;
+	if (image.depth() != depth) image.convertTo(scaled, CV_MAKETYPE(depth, image.channels()), WhiteValue(depth) / WhiteValue(image.depth()));
+
+	cv::Mat converted = scaled;
+	if (scaled.channels() != cn) cv::cvtColor(scaled, converted, cn == 1 ? cv::COLOR_BGR2GRAY : cv::COLOR_GRAY2BGR);
+	return converted;
+}
+
+//Parses colors in #RRGGBB or RRGGBB format into BGR
+bool PanoProcessing::ParseColorString(const BString& colorString, cv::Vec3b& bgr)
+{
+	BString str = colorString;
+	if (str.GetLength() > 0 && str[0] == '#') str = str.Mid(1);
+	if (str.GetLength() != 6) return false;
+
+	unsigned int rgb = 0;
+	for (int i = 0; i < 6; i++)
+	{
+		char c = str[i];
+		unsigned int digit;
+		if (c >= '0' && c <= '9') digit = c - '0';
+		else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+		else return false;
+
+		rgb = rgb * 16 + digit;
+	}
+
+	bgr = cv::Vec3b(uchar(rgb & 0xFF), uchar((rgb >> 8) & 0xFF), uchar((rgb >> 16) & 0xFF));
+	return true;
+}
+
+bool PanoProcessing::IsEquirectangular(int width, int height)
+{
+	return width > 0 && height > 0 && int64(width) == int64(height) * 2;
+}
+
+//The default of OpenCV's CV_IO_MAX_IMAGE_PIXELS
+bool PanoProcessing::IsTooBigToDecode(cv::Size size)
+{
+	return int64(size.width) * int64(size.height) > (int64(1) << 30);
+}
+
+//Exiv2 reads the size from the JPEG SOF marker or the TIFF IFD, and stops before the image data
+//BigTIFF files, which Exiv2 can't open, get their size from BigTiff::Reader
+bool PanoProcessing::ReadImageHeader(const BString& filename, ImageHeader& header, bool fReadThumbnail)
+{
+	header = ImageHeader();
+
+	try
+	{
+		Exiv2::Image::AutoPtr imageFile = Exiv2::ImageFactory::open(filename);
+		if (!imageFile.get()) return BigTiff::ReadImageHeader(filename, header);
+
+		imageFile->readMetadata();
+
+		header.width = imageFile->pixelWidth();
+		header.height = imageFile->pixelHeight();
+
+		//cv::imread applies the EXIF orientation, orientations 5 to 8 swap width and height
+		Exiv2::ExifData& exifData = imageFile->exifData();
+		Exiv2::ExifData::const_iterator orientation = exifData.findKey(Exiv2::ExifKey("Exif.Image.Orientation"));
+		if (orientation != exifData.end() && orientation->count() > 0)
+		{
+			header.orientation = int(orientation->toLong());
+			if (header.orientation >= 5 && header.orientation <= 8) std::swap(header.width, header.height);
+		}
+
+		Exiv2::XmpData& xmpData = imageFile->xmpData();
+		Exiv2::XmpData::const_iterator projection = xmpData.findKey(Exiv2::XmpKey("Xmp.GPano.ProjectionType"));
+		if (projection != xmpData.end()) header.projectionType = projection->toString();
+
+		if (fReadThumbnail)
+		{
+			//Preview properties are sorted by size, the first one is the smallest
+			Exiv2::PreviewManager previewManager(*imageFile);
+			Exiv2::PreviewPropertiesList previews = previewManager.getPreviewProperties();
+			if (!previews.empty())
+			{
+				Exiv2::PreviewImage preview = previewManager.getPreviewImage(previews.front());
+				cv::Mat data(1, int(preview.size()), CV_8UC1, const_cast<Exiv2::byte*>(preview.pData()));
+				header.thumbnail = cv::imdecode(data, CV_LOAD_IMAGE_COLOR);
+			}
+		}
+	}
+	catch (Exiv2::AnyError&)
+	{
+		return BigTiff::ReadImageHeader(filename, header);
+	}
+
+	return true;
+}
+
+//The size comes from the headers; if they don't have it, the image is decoded in full
+//Uncompressed TIFFs are reduced while they are read, cv::imread would decode them in full and refuses gigapixel ones
+cv::Mat PanoProcessing::ReadReduced(const BString& filename, cv::Size minSize, cv::Size& fullSize)
+{
+	cv::Mat tiff = BigTiff::ReadReduced(filename, minSize, fullSize);
+	if (!tiff.empty()) return tiff;
+
+	ImageHeader header;
+	if (!ReadImageHeader(filename, header, false) || header.width <= 0 || header.height <= 0)
+	{
+		cv::Mat mat = cv::imread(filename, CV_LOAD_IMAGE_COLOR);
+		fullSize = mat.size();
+		return mat;
+	}
+
+	fullSize = cv::Size(header.width, header.height);
+
+	//Largest reduction first
+	const int factors[3] = { 8, 4, 2 };
+	const int flags[3] = { cv::IMREAD_REDUCED_COLOR_8, cv::IMREAD_REDUCED_COLOR_4, cv::IMREAD_REDUCED_COLOR_2 };
+
+	for (int k = 0; k < 3; k++)
+	{
+		if (header.width / factors[k] < minSize.width || header.height / factors[k] < minSize.height) continue;
+
+		cv::Mat mat = cv::imread(filename, flags[k]);
+		if (!mat.empty()) return mat;
+	}
+
+	cv::Mat mat = cv::imread(filename, CV_LOAD_IMAGE_COLOR);
+	fullSize = mat.size();
+	return mat;
+}
@@ -0,0 +1,213 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+//Image processing functions for equirectangular panoramas
+//None of these functions touch Qt widgets, so they can be used without a display (see panotwist-cli)
+//and called from worker threads, as long as each thread works on its own image
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include "BString.h"
+
+#include <functional>
+#include <vector>
+
+//Settings for patching the nadir or the zenith of a panorama
+struct PatchSettings
+{
+	enum FillType { FillAverage, FillColor, FillImage };
+
+	PatchSettings() : fEnabled(false), fNadir(true), angleDeg(0), fillType(FillAverage), color(0, 0, 0) {}
+
+	bool fEnabled;
+	bool fNadir;			//Patch nadir (true) or zenith (false)
+	double angleDeg;		//Angular size of the patch, from the pole
+	FillType fillType;
+	cv::Vec3b color;		//8-bit BGR fill color for FillColor, converted to the type of the panorama
+	cv::Mat patchImage;		//Image for FillImage, converted to the type of the panorama; nothing is patched if it is empty
+};
+
+//Sum of the pixels of a band that are not black, for the average fill
+//Whole numbers for 8 and 16-bit images, so that a band summed in parts in any order gives the same average
+struct ColorSum
+{
+	ColorSum() : numPixels(0)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			channels[k] = 0;
+			floatChannels[k] = 0;
+		}
+	}
+
+	ColorSum& operator+=(const ColorSum& other)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			channels[k] += other.channels[k];
+			floatChannels[k] += other.floatChannels[k];
+		}
+		numPixels += other.numPixels;
+		return *this;
+	}
+
+	uint64 channels[3];			//B, G, R, or only the first one for grayscale images
+	double floatChannels[3];	//Same for floating-point images, the other sum stays at 0
+	int64 numPixels;
+};
+
+//Settings for limiting the size of the output panorama
+struct RescaleSettings
+{
+	RescaleSettings() : fEnabled(false), maxHeight(0) {}
+
+	bool fEnabled;
+	int maxHeight;			//Panoramas taller than this are downscaled to maxHeight*2 x maxHeight
+};
+
+//Everything that processing a panorama depends on, as a plain value
+//Taken once when a save starts, so that any number of workers can process files with it without touching the widgets
+//The patch images are shared between copies and must not be written to
+struct ProcessingSettings
+{
+	ProcessingSettings() : rotationRad(0) {}
+
+	double rotationRad;
+	RescaleSettings rescale;
+	PatchSettings nadir;
+	PatchSettings zenith;
+};
+
+//What the file headers tell about an image, without decoding it
+struct ImageHeader
+{
+	ImageHeader() : width(0), height(0), orientation(1) {}
+
+	int width;					//Size of the image as cv::imread would return it, 0 if the headers don't tell
+	int height;
+	int orientation;			//EXIF orientation, 1 if the file has none
+	BString projectionType;		//Xmp.GPano.ProjectionType, empty if the file has none
+	cv::Mat thumbnail;			//Smallest embedded preview image, empty if there is none or it was not requested
+};
+
+namespace PanoProcessing
+{
+	//Image transformations
+	void Rescale(cv::Mat& image, const RescaleSettings& settings);
+	void Rotate(cv::Mat& image, double rotationRad);
+	void Patch(cv::Mat& image, const PatchSettings& settings);
+
+	//Patch() cuts the band out of the image and fills it with PatchBand(), which can also fill a band kept separately
+	void PatchBand(cv::Mat& band, const PatchSettings& settings);
+
+	//Pieces of PatchBand() for a band that is never in memory as a whole
+	//PatchBandRows() fills rows [firstBandRow, firstBandRow + rows.rows) of a band of bandRows rows; not for FillAverage
+	//FillAverage fills with AverageColor() of the sum of the band that AddToAverage() accumulates, part by part
+	void PatchBandRows(cv::Mat& rows, const PatchSettings& settings, int bandRows, int firstBandRow);
+	void AddToAverage(const cv::Mat& rows, ColorSum& sum);
+	cv::Scalar AverageColor(const ColorSum& sum);		//In the units of the image that was summed
+	int PatchHeight(const PatchSettings& settings, int imageRows);		//0 if patching is disabled
+	int RotationPixels(int cols, double rotationRad);					//Shift that Rotate() applies to an image with cols columns
+	cv::Size RescaledSize(cv::Size size, const RescaleSettings& settings);	//Size of the image after Rescale()
+
+	//Same result as Rescale(), Rotate(), Patch(nadir) and Patch(zenith) on a copy of src, in a single tiled pass
+	//src and dst may be the same image
+	void Process(const cv::Mat& src, cv::Mat& dst, double rotationRad, const RescaleSettings& rescale,
+				 const PatchSettings& nadir, const PatchSettings& zenith);
+	void Process(const cv::Mat& src, cv::Mat& dst, const ProcessingSettings& settings);	//Safe to call from several threads at once
+
+	//Source and destination of ProcessStrips(), 8-bit BGR like cv::imread; both return false to stop with an error
+	typedef std::function<bool(cv::Mat& rows)> ReadRowsFunction;			//Fills rows with the next rows.rows rows of the image
+	typedef std::function<bool(const cv::Mat& rows)> WriteRowsFunction;		//Takes the next rows of the result
+
+	//Same result as Process(), for an image that is read and written top to bottom, a strip of rows at a time,
+	//so that only a few strips are ever in memory; returns false if a callback failed or CanProcessInStrips() is false
+	bool ProcessStrips(cv::Size srcSize, const ReadRowsFunction& readRows, const WriteRowsFunction& writeRows,
+					   double rotationRad, const RescaleSettings& rescale, const PatchSettings& nadir, const PatchSettings& zenith);
+
+	//False if the rescaling steps are too tall for strips, or an average-filled zenith patch overlaps the nadir patch
+	bool CanProcessInStrips(cv::Size srcSize, const RescaleSettings& rescale, const PatchSettings& nadir, const PatchSettings& zenith);
+
+	//OpenCV-based functions for pixel operations
+	void HorizontalCyclicRotate(cv::Mat& mat, int numPixels);
+
+	//Inserts the GPano XMP and EXIF size tags into an image file encoded in memory, so that the file is written to disk only once
+	//Other EXIF and XMP tags of the file are kept
+	bool InsertExifTags(std::vector<uchar>& fileData, const cv::Mat& image);
+	bool InsertExifTagsForSize(std::vector<uchar>& fileData, cv::Size imageSize, double viewRotationRad);	//Also turns the initial view
+
+	//The pieces of cv::imwrite, with the tags inserted in between
+	//Images deeper than the format can store are scaled down to its deepest depth, float HDR formats get float
+	bool EncodeImage(const BString& filename, const cv::Mat& image, std::vector<uchar>& fileData);	//Format from the extension
+	bool ReadFileData(const BString& filename, std::vector<uchar>& fileData);
+	bool WriteFileData(const BString& filename, const std::vector<uchar>& fileData);
+
+	//Metadata-only save: when the settings leave every pixel as it is, copies the file with the panorama tags inserted,
+	//without decoding or encoding it; outFile must have the format of inFile, its EXIF, GPS and XMP tags are kept
+	//With fVirtualRotation the rotation is written as the initial view heading instead of moving the pixels,
+	//for viewers that honour the tag
+	//Returns false if the settings change pixels or the file can't be saved this way; nothing is written then
+	bool CopyWithExifTags(const BString& inFile, const BString& outFile, double rotationRad, bool fVirtualRotation,
+						  const RescaleSettings& rescale, const PatchSettings& nadir, const PatchSettings& zenith, cv::Size& size);
+	bool ChangesPixels(cv::Size size, double rotationRad, const RescaleSettings& rescale,
+					   const PatchSettings& nadir, const PatchSettings& zenith);	//False if Process() would return the image as it is
+
+	//cv::imwrite followed by InsertExifTags(), but with a single write of the file
+	//fTagged receives whether the tags were inserted; the file is written without them if they could not be
+	bool WriteWithExifTags(const BString& filename, const cv::Mat& image, bool& fTagged);
+
+	//The GPano XMP packet that InsertExifTags() writes, for writers that embed it themselves; empty if Exiv2 fails
+	std::string PanoramaXmpPacket(cv::Size imageSize);
+	std::string PanoramaExifBlock(cv::Size imageSize);		//Its EXIF size tags as a TIFF structure, the way JPEG APP1 holds them
+
+	//Makes Exiv2 XMP handling safe for calling the tag functions from several threads at once
+	//Call once from the main thread before starting the workers
+	void InitializeMetadataThreading();
+
+	//cv::imread for processing: 8-bit, 16-bit and float HDR images keep their depth, grayscale ones stay grayscale
+	//Other depths are converted to float; returns an empty image if the file can't be read
+	cv::Mat ReadImage(const BString& filename);
+
+	//8, 16-bit and float images of 1 or 3 channels, the types that have processing kernels
+	bool IsSupportedType(int type);
+
+	//The same picture in another supported type, white stays white and color turns into gray
+	cv::Mat ConvertToType(const cv::Mat& image, int type);
+
+	//Parses colors in #RRGGBB or RRGGBB format into BGR, returns false if the string is not a valid color
+	bool ParseColorString(const BString& colorString, cv::Vec3b& bgr);
+
+	//Width == 2 * height
+	bool IsEquirectangular(int width, int height);
+
+	//cv::imread refuses images of more than 2^30 pixels, they have to be processed in strips
+	bool IsTooBigToDecode(cv::Size size);
+
+	//Reads the JPEG SOF or TIFF IFD size, the XMP and (optionally) the embedded preview, but not the image data
+	//Returns false if the file could not be opened or parsed by Exiv2, or by BigTiff::Reader for BigTIFF files
+	bool ReadImageHeader(const BString& filename, ImageHeader& header, bool fReadThumbnail);
+
+	//Decodes the image at the smallest scale of 1/8, 1/4, 1/2 or 1 that is still at least minSize
+	//JPEGs are scaled in the DCT domain by libjpeg, so the full-resolution image is never decoded
+	//fullSize receives the size of the full-resolution image; returns an empty image if the file can't be read
+	cv::Mat ReadReduced(const BString& filename, cv::Size minSize, cv::Size& fullSize);
+};
@@ -0,0 +1,171 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+
+#include "PreviewCache.h"
+#include "PanoProcessing.h"
+
+namespace
+{
+	int64 PixelBytes(const cv::Mat& mat)
+	{
+		return int64(mat.total() * mat.elemSize());
+	}
+}
+
+PreviewCache::PreviewCache(int64 theMemoryBudget) :
+memoryBudget(theMemoryBudget),
+fShutdown(false)
+{
+	prefetcher = std::thread(&PreviewCache::PrefetchThread, this);
+}
+
+PreviewCache::~PreviewCache()
+{
+	if (1)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		fShutdown = true;
+		prefetchRequested.notify_all();
+	}
+
+	prefetcher.join();
+}
+
+//If the prefetcher is decoding the file right now, waits for it instead of decoding the file a second time
+cv::Mat PreviewCache::Get(const BString& fileName, cv::Size minSize, cv::Size& fullSize)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	prefetchDone.wait(lock, [&]{ return inFlight != fileName; });
+
+	auto it = Find(fileName, minSize);
+	if (it != entries.end())
+	{
+		stats.numHits++;
+		fullSize = it->fullSize;
+		return it->preview;
+	}
+
+	stats.numMisses++;
+	lock.unlock();
+
+	Entry entry;
+	entry.fileName = fileName;
+	entry.minSize = minSize;
+	entry.preview = PanoProcessing::ReadReduced(fileName, minSize, entry.fullSize);
+	fullSize = entry.fullSize;
+
+	lock.lock();
+	if (!entry.preview.empty() && Find(fileName, minSize) == entries.end()) Insert(entry);
+
+	return entry.preview;
+}
+
+void PreviewCache::Prefetch(const CHArray<BString>& fileNames, cv::Size minSize)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	prefetchList = fileNames;
+	prefetchSize = minSize;
+	prefetchRequested.notify_all();
+}
+
+void PreviewCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	prefetchList.Clear();
+	entries.clear();
+	stats.numEntries = 0;
+	stats.memoryBytes = 0;
+}
+
+PreviewCache::Stats PreviewCache::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+//Takes the files from the front of the prefetch list one at a time, so that a new list takes effect after the current file
+void PreviewCache::PrefetchThread()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true)
+	{
+		prefetchRequested.wait(lock, [this]{ return fShutdown || !prefetchList.IsEmpty(); });
+		if (fShutdown) return;
+
+		BString fileName = prefetchList[0];
+		cv::Size minSize = prefetchSize;
+		prefetchList.RemovePointAt(0);
+
+		if (Find(fileName, minSize) != entries.end()) continue;
+
+		inFlight = fileName;
+		lock.unlock();
+
+		Entry entry;
+		entry.fileName = fileName;
+		entry.minSize = minSize;
+		entry.preview = PanoProcessing::ReadReduced(fileName, minSize, entry.fullSize);
+
+		lock.lock();
+		if (!entry.preview.empty())
+		{
+			Insert(entry);
+			stats.numPrefetched++;
+		}
+
+		inFlight.clear();
+		prefetchDone.notify_all();
+	}
+}
+
+//Moves the entry to the front of the list if it is found
+std::list<PreviewCache::Entry>::iterator PreviewCache::Find(const BString& fileName, cv::Size minSize)
+{
+	for (auto it = entries.begin(); it != entries.end(); ++it)
+	{
+		if (it->fileName == fileName && it->minSize == minSize)
+		{
+			entries.splice(entries.begin(), entries, it);
+			return entries.begin();
+		}
+	}
+
+	return entries.end();
+}
+
+//Evicts the least recently used previews until the new one fits into the budget
+//The newest preview is always kept, even if it is larger than the whole budget
+void PreviewCache::Insert(const Entry& entry)
+{
+	entries.push_front(entry);
+	stats.memoryBytes += PixelBytes(entry.preview);
+
+	while (stats.memoryBytes > memoryBudget && entries.size() > 1)
+	{
+		stats.memoryBytes -= PixelBytes(entries.back().preview);
+		entries.pop_back();
+	}
+
+	stats.numEntries = int(entries.size());
+}
@@ -0,0 +1,98 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+
+//Memory-budgeted LRU cache of reduced-resolution previews for Prev/Next navigation in PanoTwist
+//A background thread prefetches the previews of the files next to the current one,
+//so that stepping through a folder does not wait for the disk and the JPEG decoder
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include "Array.h"
+
+#include <list>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+class PreviewCache
+{
+public:
+	//Observable state of the cache
+	struct Stats
+	{
+		Stats() : numHits(0), numMisses(0), numPrefetched(0), numEntries(0), memoryBytes(0) {}
+
+		int numHits;			//Get() found the preview in the cache (or waited for the prefetcher to finish it)
+		int numMisses;			//Get() had to decode the file itself
+		int numPrefetched;		//Previews decoded by the background thread
+		int numEntries;
+		int64 memoryBytes;		//Pixel memory of the cached previews
+	};
+
+public:
+	explicit PreviewCache(int64 theMemoryBudget);
+	~PreviewCache();
+
+	//Returns the preview of the file decoded by PanoProcessing::ReadReduced(), from the cache if possible
+	//fullSize receives the size of the full-resolution image
+	cv::Mat Get(const BString& fileName, cv::Size minSize, cv::Size& fullSize);
+
+	//Replaces the list of files to decode in the background, the first ones are decoded first
+	//Files that are already cached are skipped
+	void Prefetch(const CHArray<BString>& fileNames, cv::Size minSize);
+
+	void Clear();
+	Stats GetStats() const;
+
+private:
+	struct Entry
+	{
+		BString fileName;
+		cv::Size minSize;
+		cv::Size fullSize;
+		cv::Mat preview;
+	};
+
+	void PrefetchThread();
+
+	//These expect the mutex to be locked
+	std::list<Entry>::iterator Find(const BString& fileName, cv::Size minSize);
+	void Insert(const Entry& entry);
+
+private:
+	const int64 memoryBudget;
+
+	mutable std::mutex mutex;
+	std::condition_variable prefetchRequested;		//New prefetch list or shutdown
+	std::condition_variable prefetchDone;			//The prefetcher finished a file
+
+	std::list<Entry> entries;				//Most recently used first
+	Stats stats;
+
+	CHArray<BString> prefetchList;
+	cv::Size prefetchSize;
+	BString inFlight;						//The file the prefetcher is decoding right now
+	bool fShutdown;
+
+	std::thread prefetcher;
+};
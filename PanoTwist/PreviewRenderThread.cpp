@@ -0,0 +1,125 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+
+#include "PreviewRenderThread.h"
+
+PreviewRenderThread::PreviewRenderThread(FrameReadyFunction theFrameReadyFunction) :
+frameInterval(16),		//About 60 frames per second
+frameReadyFunction(theFrameReadyFunction),
+fNewSource(false),
+fRequested(false),
+fNewFrame(false),
+fShutdown(false)
+{
+	renderThread = std::thread(&PreviewRenderThread::RenderThread, this);
+}
+
+PreviewRenderThread::~PreviewRenderThread()
+{
+	Stop();
+}
+
+void PreviewRenderThread::Stop()
+{
+	if (1)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		fShutdown = true;
+		requested.notify_all();
+	}
+
+	if (renderThread.joinable()) renderThread.join();
+}
+
+void PreviewRenderThread::SetSource(const cv::Mat& source)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	pendingSource = source;
+	fNewSource = true;
+}
+
+void PreviewRenderThread::Request(const PatchSettings& nadir, const PatchSettings& zenith)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	pendingNadir = nadir;
+	pendingZenith = zenith;
+	fRequested = true;
+	requested.notify_all();
+}
+
+bool PreviewRenderThread::TakeFrame(Frame& outFrame)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!fNewFrame) return false;
+
+	outFrame = frame;
+	fNewFrame = false;
+	return true;
+}
+
+void PreviewRenderThread::RenderThread()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	auto nextFrameTime = std::chrono::steady_clock::now();
+
+	while (true)
+	{
+		requested.wait(lock, [this]{ return fShutdown || fRequested; });
+		if (fShutdown) return;
+
+		//Paced to the display - requests that arrive in the meantime replace this one
+		if (requested.wait_until(lock, nextFrameTime, [this]{ return fShutdown; })) return;
+
+		if (fNewSource)
+		{
+			renderer.SetSource(pendingSource);
+			pendingSource.release();
+			fNewSource = false;
+		}
+
+		PatchSettings nadir = pendingNadir;
+		PatchSettings zenith = pendingZenith;
+		fRequested = false;
+
+		lock.unlock();
+
+		//Render() reuses its buffer, the frame needs its own copy for the interface thread
+		Frame newFrame;
+		newFrame.image = renderer.Render(0, nadir, zenith).clone();
+
+		int rows = newFrame.image.rows;
+		newFrame.firstRotatedRow = PanoProcessing::PatchHeight(zenith, rows);
+		newFrame.lastRotatedRow = std::max(newFrame.firstRotatedRow, rows - PanoProcessing::PatchHeight(nadir, rows));
+
+		nextFrameTime = std::chrono::steady_clock::now() + frameInterval;
+
+		lock.lock();
+		if (fShutdown) return;
+		frame = newFrame;
+		fNewFrame = true;
+
+		lock.unlock();
+		frameReadyFunction();
+		lock.lock();
+	}
+}
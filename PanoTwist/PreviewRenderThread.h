@@ -0,0 +1,92 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+
+//Runs the PreviewRenderer of PanoTwist on its own thread, so that input handling never waits for image processing
+//Only the most recent request is rendered; requests that arrive while a frame is being rendered replace each other,
+//and frames are started no more often than the display refreshes
+#pragma once
+
+#include "PreviewRenderer.h"
+
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+
+class PreviewRenderThread
+{
+public:
+	//A rendered preview: unrotated, with patched nadir and zenith
+	struct Frame
+	{
+		Frame() : firstRotatedRow(0), lastRotatedRow(0) {}
+
+		cv::Mat image;
+		int firstRotatedRow;		//Rows [firstRotatedRow, lastRotatedRow) move with the rotation, the patches don't
+		int lastRotatedRow;
+	};
+
+	//Called from the render thread after each frame
+	typedef std::function<void()> FrameReadyFunction;
+
+public:
+	explicit PreviewRenderThread(FrameReadyFunction theFrameReadyFunction);
+	~PreviewRenderThread();
+
+	//The source must not be modified after it is passed here
+	void SetSource(const cv::Mat& source);
+
+	//Replaces any request that has not been started yet
+	void Request(const PatchSettings& nadir, const PatchSettings& zenith);
+
+	//Returns false if there is no new frame since the last call
+	bool TakeFrame(Frame& frame);
+
+	//Joins the render thread, after it returns the frame-ready function is not called any more
+	//The owner calls it before the objects the function uses are destroyed; the destructor calls it too
+	void Stop();
+
+private:
+	void RenderThread();
+
+private:
+	const std::chrono::milliseconds frameInterval;
+	FrameReadyFunction frameReadyFunction;
+
+	std::mutex mutex;
+	std::condition_variable requested;
+
+	//Guarded by the mutex
+	cv::Mat pendingSource;
+	bool fNewSource;
+	PatchSettings pendingNadir;
+	PatchSettings pendingZenith;
+	bool fRequested;
+	Frame frame;
+	bool fNewFrame;
+	bool fShutdown;
+
+	PreviewRenderer renderer;		//Only used by the render thread
+	std::thread renderThread;
+};
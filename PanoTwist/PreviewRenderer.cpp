@@ -0,0 +1,107 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+
+#include "PreviewRenderer.h"
+
+namespace
+{
+	//Everything PatchBand() depends on, besides the pixels of the band
+	//Patch images are compared by buffer; this is only safe because the cached settings keep their image alive
+	bool SameSettings(const PatchSettings& a, const PatchSettings& b)
+	{
+		if (a.fEnabled != b.fEnabled) return false;
+		if (!a.fEnabled) return true;
+
+		return a.fNadir == b.fNadir && a.angleDeg == b.angleDeg && a.fillType == b.fillType && a.color == b.color &&
+			a.patchImage.data == b.patchImage.data && a.patchImage.size() == b.patchImage.size();
+	}
+}
+
+void PreviewRenderer::SetSource(const cv::Mat& theSource)
+{
+	source = theSource;
+	nadirBand.fValid = false;
+	zenithBand.fValid = false;
+}
+
+cv::Mat PreviewRenderer::Render(double rotationRad, const PatchSettings& nadir, const PatchSettings& zenith)
+{
+	if (source.empty()) return cv::Mat();
+
+	int rows = source.rows;
+	int cols = source.cols;
+	int nadirRows = PanoProcessing::PatchHeight(nadir, rows);
+	int zenithRows = PanoProcessing::PatchHeight(zenith, rows);
+
+	//When the bands overlap, the zenith patch sees the nadir patch underneath - nothing to cache
+	if (nadirRows + zenithRows > rows)
+	{
+		PanoProcessing::Process(source, result, rotationRad, RescaleSettings(), nadir, zenith);
+		return result;
+	}
+
+	UpdateBand(nadirBand, nadir);
+	UpdateBand(zenithBand, zenith);
+
+	result.create(source.size(), source.type());
+
+	if (zenithRows > 0) zenithBand.pixels.copyTo(result.rowRange(0, zenithRows));
+	if (nadirRows > 0) nadirBand.pixels.copyTo(result.rowRange(rows - nadirRows, rows));
+
+	//Cyclic shift of the rows between the bands, as two block copies
+	int shift = PanoProcessing::RotationPixels(cols, rotationRad) % cols;
+	if (shift < 0) shift += cols;
+
+	cv::Range middle(zenithRows, rows - nadirRows);
+	if (middle.size() > 0)
+	{
+		source(middle, cv::Range(0, cols - shift)).copyTo(result(middle, cv::Range(shift, cols)));
+		if (shift > 0) source(middle, cv::Range(cols - shift, cols)).copyTo(result(middle, cv::Range(0, shift)));
+	}
+
+	return result;
+}
+
+//The band is patched from the unrotated source; the average color of a band does not depend on the rotation
+void PreviewRenderer::UpdateBand(Band& band, const PatchSettings& settings)
+{
+	if (band.fValid && SameSettings(band.settings, settings)) return;
+
+	band.settings = settings;
+	band.fValid = true;
+
+	//An image over external data is not reference counted, its buffer could be freed and reused at the same address;
+	//the copy never compares equal, so such bands are simply not reused
+	if (!settings.patchImage.empty() && settings.patchImage.u == nullptr) band.settings.patchImage = settings.patchImage.clone();
+
+	int bandRows = PanoProcessing::PatchHeight(settings, source.rows);
+	if (bandRows == 0)
+	{
+		band.pixels.release();
+		return;
+	}
+
+	cv::Range range = settings.fNadir ? cv::Range(source.rows - bandRows, source.rows) : cv::Range(0, bandRows);
+	source.rowRange(range).copyTo(band.pixels);
+	PanoProcessing::PatchBand(band.pixels, settings);
+}
@@ -0,0 +1,63 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+
+//Renders the interactive preview of PanoTwist incrementally
+//The nadir and zenith patches are applied after the rotation and fill whole rows, so they don't depend on it:
+//the patched bands are cached and only recomputed when their settings or the source change,
+//and a rotation only shifts the rows between the bands
+#pragma once
+
+#include "PanoProcessing.h"
+
+class PreviewRenderer
+{
+public:
+	PreviewRenderer(){}
+	~PreviewRenderer(){}
+
+	//A new preview image drops all cached bands
+	void SetSource(const cv::Mat& theSource);
+
+	//Same result as PanoProcessing::Process() of the source without rescaling
+	//The returned image is overwritten by the next call
+	cv::Mat Render(double rotationRad, const PatchSettings& nadir, const PatchSettings& zenith);
+
+private:
+	//A patched band, valid for the settings it was computed with
+	struct Band
+	{
+		Band() : fValid(false) {}
+
+		bool fValid;
+		PatchSettings settings;		//Holds a reference to the patch image, so its buffer is not reused while the band is cached
+		cv::Mat pixels;
+	};
+
+	void UpdateBand(Band& band, const PatchSettings& settings);
+
+private:
+	cv::Mat source;
+	cv::Mat result;
+	Band nadirBand;
+	Band zenithBand;
+};
@@ -35,6 +35,14 @@ bool Savable::Save(const BString& fileName)
 	BArchive ar(outstream);
 	Serialize(ar);
 
+	//Write errors of the last buffer only show up when it is flushed
+	outstream.close();
+	if(outstream.fail())
+	{
+		std::cerr << "Could not write file: " << fileName << ".\n";
+		return false;
+	}
+
 	return true;
 }
 
@@ -49,7 +57,14 @@ bool Savable::Load(const BString& fileName)
 
 	BArchive ar(instream);
 	Serialize(ar);
-	
+
+	//Truncated or corrupt files fail the stream
+	if(instream.fail())
+	{
+		std::cerr << "Could not read file: " << fileName << ".\n";
+		return false;
+	}
+
 	return true;
 }
 
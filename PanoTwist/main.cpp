@@ -21,11 +21,13 @@
 */
 
 #include "panotwist.h"
+#include "PanoProcessing.h"
 #include <QtWidgets/QApplication>
 
 int main(int argc, char *argv[])
 {
 	QApplication a(argc, argv);
+	PanoProcessing::InitializeMetadataThreading();
 	PanoTwist w;
 	w.show();
 	return a.exec();
@@ -32,10 +32,15 @@
 #include "DialogSaveAll.h"
 #include "DialogAbout.h"
 
-#include <exiv2/exiv2.hpp>
+#include "PanoProcessing.h"
+#include "JpegLossless.h"
+#include "JpegStream.h"
+#include "BigTiff.h"
 
 PanoTwist::PanoTwist(QWidget *parent):
 	QMainWindow(parent),
+	previewCache(256 * 1024 * 1024LL),		//A few dozen previews
+	previewRenderThread([this]() { emit SignalPreviewRendered(); }),
 	Pi(3.1415926535897932)
 {
 	ui.setupUi(this);
@@ -47,6 +52,7 @@ PanoTwist::PanoTwist(QWidget *parent):
 	saveSubfolderName = "Panotwist output/";
 
 	imageWidget = new CvImageWidget(ui.scrollAreaImage);
+	imageWidget->SetCrosshair(40, 2, QColor(255, 0, 0));
 
 	QHBoxLayout* nadirLayout = new QHBoxLayout(this);
 	nadirLayout->setMargin(0);
@@ -79,6 +85,9 @@ PanoTwist::PanoTwist(QWidget *parent):
 	QObject::connect(nadirWidget, &NadirZenithWidget::SignalSettingsChanged, this, &PanoTwist::OnNadirZenithChanged);
 	QObject::connect(zenithWidget, &NadirZenithWidget::SignalSettingsChanged, this, &PanoTwist::OnNadirZenithChanged);
 
+	//Frames from the render thread are shown in the interface thread
+	QObject::connect(this, &PanoTwist::SignalPreviewRendered, this, &PanoTwist::OnPreviewRendered, Qt::QueuedConnection);
+
 	//Connect events from the image widget
 	QObject::connect(imageWidget, &CvImageWidget::MouseLeftPressed, this, &PanoTwist::OnImageMouseLeftPressed);
 	QObject::connect(imageWidget, &CvImageWidget::MouseLeftReleased, this, &PanoTwist::OnImageMouseLeftReleased);
@@ -89,6 +98,12 @@ PanoTwist::PanoTwist(QWidget *parent):
 	Init();
 }
 
+//The render thread emits a signal of this object, it has to stop before the members are destroyed
+PanoTwist::~PanoTwist()
+{
+	previewRenderThread.Stop();
+}
+
 void PanoTwist::Init()
 {
 	fileArray.Clear();
@@ -97,10 +112,15 @@ void PanoTwist::Init()
 
 	curIndex = -1;
 
+	previewCache.Clear();
+
 	scaledSize = cv::Size(imageWidget->AvailableWidth()+1,imageWidget->AvailableHeight()+1);
 	scaledMat = cv::Mat::zeros(scaledSize, CV_8UC3);
+	previewRenderThread.SetSource(scaledMat);
 
 	rotationRad = 0;
+	rotatedFirstRow = 0;
+	rotatedLastRow = 0;
 
 	ui.labelCurrentFolder->setText("");
 	ui.labelCurrentFile->setText("");
@@ -136,14 +156,21 @@ void PanoTwist::UpdateInterface()
 	
 	setCursor(Qt::WaitCursor);
 
-	//Read the current file
-	fullMat = cv::imread(fileArray[curIndex], CV_LOAD_IMAGE_COLOR);
+	//Read the current file at a reduced scale that is just big enough for the preview
+	//The full-size image is only read when it is saved
+	cv::Mat reducedMat = previewCache.Get(fileArray[curIndex], scaledSize, fullSize);
+	PrefetchNeighbours();
 
 	int interpMethod;
-	if (fullMat.cols >= scaledMat.cols) interpMethod = cv::INTER_AREA;
+	if (reducedMat.cols >= scaledMat.cols) interpMethod = cv::INTER_AREA;
 	else interpMethod = cv::INTER_LINEAR;
 
-	cv::resize(fullMat, scaledMat, scaledSize, 0, 0, interpMethod);
+	//A new image every time, the render thread may still be using the previous one
+	cv::Mat newScaledMat = cv::Mat::zeros(scaledSize, CV_8UC3);
+	if (!reducedMat.empty()) cv::resize(reducedMat, newScaledMat, scaledSize, 0, 0, interpMethod);
+	scaledMat = newScaledMat;
+
+	previewRenderThread.SetSource(scaledMat);
 
 	setCursor(Qt::ArrowCursor);
 
@@ -153,10 +180,16 @@ void PanoTwist::UpdateInterface()
 		curIndex + 1,
 		fileArray.Count(),
 		nameOnlyArray[curIndex],
-		fullMat.cols,
-		fullMat.rows);
+		fullSize.width,
+		fullSize.height);
 	ui.labelCurrentFile->setText(fileString.c_str());
 
+	PreviewCache::Stats stats = previewCache.GetStats();
+	BString cacheString;
+	cacheString.Format("Preview cache: %i hits, %i misses, %i prefetched, %i previews in %.1f MB",
+		stats.numHits, stats.numMisses, stats.numPrefetched, stats.numEntries, double(stats.memoryBytes) / (1024. * 1024.));
+	ui.labelCurrentFile->setToolTip(cacheString.c_str());
+
 	//The rotation position is zero after loading
 	rotationRad = 0;
 	
@@ -164,173 +197,66 @@ void PanoTwist::UpdateInterface()
 	ShowImage();
 }
 
+//The next file first, since stepping forward is the most common
+void PanoTwist::PrefetchNeighbours()
+{
+	CHArray<BString> neighbours;
+	const int offsets[4] = { 1, -1, 2, -2 };
+	for (int offset : offsets)
+	{
+		int index = curIndex + offset;
+		if (index >= 0 && index < fileArray.Count()) neighbours << fileArray[index];
+	}
+
+	previewCache.Prefetch(neighbours, scaledSize);
+}
+
 //Show image of the current rotated scaledImage with crosshairs drawn in the middle
+//Nadir and zenith are patched by the render thread, the frame is shown by OnPreviewRendered()
 void PanoTwist::ShowImage()
 {
 	if (curIndex == -1) return;
 
-	cv::Mat temp;
-	scaledMat.copyTo(temp);
-	
-	//Apply rotation and process nadir and zenith
-	ProcessImage(temp, true, false);
-
-	//Draw a cross in the center
-	int xSize = scaledSize.width;
-	int ySize = scaledSize.height;
-	int lineLength = 40;
-	int thickness = 2;
-	int centerX = xSize / 2;
-	int centerY = ySize / 2;
-	cv::Scalar color(0,0,255);
-
-	cv::line(temp, cv::Point(centerX, centerY - lineLength), cv::Point(centerX, centerY + lineLength), color, thickness);
-	cv::line(temp, cv::Point(centerX - lineLength, centerY), cv::Point(centerX + lineLength, centerY), color, thickness);
-
-	imageWidget->ShowImage(temp);
+	previewRenderThread.Request(nadirWidget->Settings(), zenithWidget->Settings());
 }
 
-//Apply current rotation and patch nadir-zenith in the image provided
-void PanoTwist::ProcessImage(cv::Mat& image, bool fRotate, bool fRescale)
+//The image widget gets the unrotated image with patched nadir and zenith, and shifts the rows between them itself
+void PanoTwist::OnPreviewRendered()
 {
-	if (fRescale) InternalRescale(image);
-	if(fRotate) InternalRotate(image);
-	InternalPatch(image, nadirWidget);
-	InternalPatch(image, zenithWidget);
-}
+	if (curIndex == -1) return;
 
-//Rescale the image if the maxSizeWidget is enabled
-//And image size is greater than allowed
-void PanoTwist::InternalRescale(cv::Mat& image)
-{
-	if (!maxSizeWidget->IsEnabled()) return;
+	PreviewRenderThread::Frame frame;
+	if (!previewRenderThread.TakeFrame(frame)) return;
 
-	int maxHeight = maxSizeWidget->MaxPermittedHeight();
-	if (maxHeight >= image.rows) return;
+	rotatedFirstRow = frame.firstRotatedRow;
+	rotatedLastRow = frame.lastRotatedRow;
 
-	//Yes, the image is bigger than allowed - rescale it down
-	cv::resize(image, image, cv::Size(maxHeight * 2, maxHeight), 0, 0, cv::INTER_AREA);
+	imageWidget->ShowImage(frame.image);
+	ShowRotation();
 }
 
-//Internal function to rotate the image in the azimuth angle
-void PanoTwist::InternalRotate(cv::Mat& image)
+//Only changes the offset at which the image widget draws the rows between the patches
+void PanoTwist::ShowRotation()
 {
-	double rotAngle = fmod(rotationRad, 2*Pi);
-	int rotationPixels = int(double(image.cols) * rotAngle / (2*Pi));
+	if (curIndex == -1) return;
 
-	HorizontalCyclicRotate(image, rotationPixels);
+	imageWidget->SetWrapOffset(PanoProcessing::RotationPixels(scaledMat.cols, rotationRad), rotatedFirstRow, rotatedLastRow);
 }
 
-//Internal function called by ProcessNadirZenith()
-void PanoTwist::InternalPatch(cv::Mat& image, NadirZenithWidget* nzWidget)
+//Snapshot of the current rotation, rescaling and nadir-zenith settings, read from the widgets on the GUI thread
+//The patch images are copied, so the snapshot shares nothing with the widgets and any thread may use it
+ProcessingSettings PanoTwist::CurrentSettings(bool fRotate, bool fRescale)
 {
-	if (!nzWidget->IsEnabled()) return;
-
-	bool fNadir = nzWidget->IsNadir();
-	double angleDeg = nzWidget->AngleDeg();
-	double angleRad = angleDeg / 180.0 * Pi;
+	ProcessingSettings settings;
+	if (fRotate) settings.rotationRad = rotationRad;
+	if (fRescale) settings.rescale = maxSizeWidget->Settings();
 
-	int xSize = image.cols;
-	int ySize = image.rows;
+	settings.nadir = nadirWidget->Settings();
+	settings.zenith = zenithWidget->Settings();
+	settings.nadir.patchImage = settings.nadir.patchImage.clone();
+	settings.zenith.patchImage = settings.zenith.patchImage.clone();
 
-	//The height of the patch in equirectangular projection
-	int nzHeight = int(double(ySize) * angleDeg / 180.0 / 2);
-
-	if (nzHeight == 0) return;
-
-	//The location of the patch - either at the top or bottom
-	int yStartPoint;
-	if (fNadir) yStartPoint = ySize - nzHeight;
-	else yStartPoint = 0;
-	
-	cv::Mat dest(image, cv::Rect(0, yStartPoint, xSize, nzHeight));
-	
-	if (nzWidget->IsFillAverage())			//Filled by average color
-	{
-		cv::Vec3d bgr = cv::Vec3d(0,0,0);
-		int numPixelsIncluded = 0;		//We will exclude black pixels from the calculation
-
-		//Sum of all pixel values
-		for (int i = 0; i < dest.cols; i++)
-		{
-			for (int j = 0; j < dest.rows; j++)
-			{
-				cv::Vec3b curPixel = dest.at<cv::Vec3b>(j, i);
-				
-				//Exclude black pixels
-				if (curPixel(0) > 0 && curPixel(1) >0 && curPixel(2) > 0)
-				{
-					numPixelsIncluded++;
-					bgr += curPixel;
-				}
-			}
-		}
-
-		cv::Vec3b avColor(0,0,0);
-		if (numPixelsIncluded > 0)
-		{
-			double num = numPixelsIncluded;
-			avColor = cv::Vec3b(bgr(0) / num, bgr(1) / num, bgr(2) / num);
-		}
-
-		cv::Mat patchImage(nzHeight, xSize, image.type(), avColor);
-		patchImage.copyTo(dest);
-	}
-
-	else if (nzWidget->IsFillColor())		//Filled by specified color
-	{
-		BString colorString = nzWidget->ColorString();
-
-		QColor color(colorString.c_str());
-
-		cv::Mat patchImage( nzHeight, xSize, image.type(), cv::Vec3b(color.blue(), color.green(), color.red()) );
-		patchImage.copyTo(dest);
-	}
-
-	else if (nzWidget->IsFillImage() && nzWidget->IsPatchImageLoaded())		//Filled by image
-	{
-		cv::Mat patchImage = nzWidget->PatchImage();
-
-		//The size of the patch image, in distances between pixels
-		int patchXsize = patchImage.cols-1;
-		int patchYsize = patchImage.rows-1;
-
-		double patchXcenter = double(patchXsize) / 2.;
-		double patchYcenter = double(patchYsize) / 2.;
-		
-		//Diameter and radius of the circle from the patch image that we'll be using
-		//In pixels
-		double diameter = std::min(patchXsize, patchYsize);
-		double radius = diameter / 2.;
-
-		//Direction constant depending on whether this is nadir or zenith
-		double dirConst = -1;
-		if (fNadir) dirConst = 1;
-
-		//For every pixel in the destination matrix, find an interpolated pixel from the patch image
-		for (int i = 0; i < dest.rows; i++)				//polar angle coordinate
-		{
-			for (int j = 0; j < dest.cols; j++)			//azimuthal angle coordinate
-			{
-				//Polar coordinates in the patch image
-				double r = double(i) / double(dest.rows - 1) * radius;
-				double phi = double(j) / double(dest.cols) * 2. * Pi + Pi / 2.;
-
-				//Cartesian coordinates in the patch image
-				double x = patchXcenter + r * cos(phi);
-				double y = patchYcenter + dirConst * r * sin(phi);
-
-				cv::Vec3b interpPixelValue = InterpolatePixel(patchImage, cv::Point2f(float(x), float(y)),
-												cv::BORDER_REFLECT_101, cv::BORDER_REFLECT_101);
-
-				int rowCoord;
-				if (fNadir) rowCoord = dest.rows - i - 1;
-				else rowCoord = i;
-
-				dest.at<cv::Vec3b>(rowCoord, j) = interpPixelValue;
-			}
-		}
-	}
+	return settings;
 }
 
 //User is opening a new folder
@@ -448,41 +374,147 @@ void PanoTwist::OnApplyClicked()
 
 	//Folder where the results are going to be saved
 	BString resultsFolder = curFolder + saveSubfolderName;
+	BString newFileName = resultsFolder + nameOnlyArray[curIndex];
+
+	const ProcessingSettings settings = CurrentSettings(true, true);
+
+	//Nothing to rotate, rescale or patch: only the tags are added
+	cv::Size size;
+	if (PanoProcessing::CopyWithExifTags(fileArray[curIndex], newFileName, settings.rotationRad, false, settings.rescale,
+		settings.nadir, settings.zenith, size))
+	{
+		BString info = "Saved file " + nameOnlyArray[curIndex] + " (panorama tags only)";
+		ui.statusBar->showMessage(info.c_str(), 2000);
+
+		setCursor(Qt::ArrowCursor);
+		return;
+	}
+
+	//The tags are written with the image; a file is still saved if they could not be made
+	bool fTagged;
+	const char* tagInfo = " (could not write panorama tags)";
+
+	if (SaveInDctDomain(fileArray[curIndex], newFileName, settings, fTagged))
+	{
+		bool fPatched = settings.nadir.fEnabled || settings.zenith.fEnabled;
+		BString info = "Saved file " + nameOnlyArray[curIndex] + (fPatched ? " (only the patched rows re-encoded)" : " (lossless rotation)");
+		if (!fTagged) info += tagInfo;
+		ui.statusBar->showMessage(info.c_str(), 2000);
+
+		setCursor(Qt::ArrowCursor);
+		return;
+	}
+
+	if (SaveInStrips(fileArray[curIndex], newFileName, settings, fTagged))
+	{
+		BString info = "Saved file " + nameOnlyArray[curIndex];
+		if (!fTagged) info += tagInfo;
+		ui.statusBar->showMessage(info.c_str(), 2000);
+
+		setCursor(Qt::ArrowCursor);
+		return;
+	}
 	
-	//Copy original full-size image and process it
+	//Read the original full-size image, in its own depth and channels, and process it
+	cv::Mat fullMat = PanoProcessing::ReadImage(fileArray[curIndex]);
+	if (fullMat.empty())
+	{
+		setCursor(Qt::ArrowCursor);
+		QtUtils::ErrorBox("Unable to read " + fileArray[curIndex] + ". The file could not be saved.");
+		return;
+	}
+
 	cv::Mat temp;
-	fullMat.copyTo(temp);
-	ProcessImage(temp, true, true);
+	PanoProcessing::Process(fullMat, temp, settings);
 
-	//Write it in the results folder
-	BString newFileName = resultsFolder + nameOnlyArray[curIndex];
-	imwrite(newFileName, temp);
+	//Write it in the results folder, with the panorama Exif tag inserted before the single write
+	if (!PanoProcessing::WriteWithExifTags(newFileName, temp, fTagged))
+	{
+		setCursor(Qt::ArrowCursor);
+		QtUtils::ErrorBox("Unable to write " + newFileName + ".");
+		return;
+	}
 
 	BString info = "Saved file " + nameOnlyArray[curIndex];
+	if (!fTagged) info += tagInfo;
 	ui.statusBar->showMessage(info.c_str(), 2000);
 
-	//Add the panorama Exif tag
-	InsertExifTags(newFileName, temp);
-
 	setCursor(Qt::ArrowCursor);
 }
 
+//Without rescaling, a JPEG can be rotated by moving its DCT blocks instead of its pixels,
+//and only the MCU rows with the nadir and zenith patches need to be decoded and encoded again
+//The rotation is not rounded, so only rotations by whole MCU columns, 8 or 16 pixels, are saved this way;
+//the others are decoded, so that the file is the same as the preview
+//The panorama tags are written with the image, fTagged receives whether they were
+//Returns false if the file can't be saved this way; nothing is written then
+bool PanoTwist::SaveInDctDomain(const BString& filename, const BString& newFileName, const ProcessingSettings& settings, bool& fTagged)
+{
+	cv::Size size;
+	return JpegLossless::ProcessFile(filename, newFileName, settings.rotationRad, false, settings.rescale,
+		settings.nadir, settings.zenith, size, fTagged);
+}
+
+//Same result as reading the whole image, PanoProcessing::Process() and imwrite(), but only a strip of rows is in memory at a time,
+//so panoramas too big to decode can still be saved
+//Only files that cv::imread would refuse are saved this way, the others are decoded as in batch saving and the CLI;
+//uncompressed TIFF results are not compressed
+//The panorama tags are written with the image, fTagged receives whether they were
+//Returns false if the file can't be saved this way; nothing is written then
+bool PanoTwist::SaveInStrips(const BString& filename, const BString& newFileName, const ProcessingSettings& settings, bool& fTagged)
+{
+	ImageHeader header;
+	if (!PanoProcessing::ReadImageHeader(filename, header, false) || !PanoProcessing::IsTooBigToDecode(cv::Size(header.width, header.height))) return false;
+
+	cv::Size size;
+	return JpegStream::ProcessFile(filename, newFileName, settings.rotationRad, settings.rescale, settings.nadir, settings.zenith, size, fTagged) ||
+		BigTiff::ProcessFile(filename, newFileName, settings.rotationRad, settings.rescale, settings.nadir, settings.zenith, size, fTagged);
+}
+
 //Batch save
 //User wants to apply the nadir and zenith settings to all files
 //Also rescales as needed, but does not rotate
 void PanoTwist::OnApplyToAllClicked()
 {
-	using namespace std::placeholders;
 	if (!FileSaveChecks()) return;
 
+	//The settings are read from the widgets once, the workers only see this snapshot,
+	//so the images are processed by as many threads as the pipeline wants
+	//Batch save does not rotate, but rescales if needed
+	const ProcessingSettings settings = CurrentSettings(false, true);
+	auto processingFunction = [settings](cv::Mat& mat) { PanoProcessing::Process(mat, mat, settings); };
+
+	//Files whose pixels stay as they are only get the tags, without decoding them
+	//JPEGs that need no rescaling only have their patched rows decoded, panoramas too big to decode are processed in strips
+	//The decoders call this, so it gets copies of the settings
+	RescaleSettings rescale = settings.rescale;
+	PatchSettings nadir = settings.nadir;
+	PatchSettings zenith = settings.zenith;
+	auto directFunction = [=](const BString& inFile, const BString& outFile, bool& fTagged) -> bool
+	{
+		//The writers add the tags themselves, so the file is written once
+		cv::Size size;
+		fTagged = true;
+		if (PanoProcessing::CopyWithExifTags(inFile, outFile, 0, false, rescale, nadir, zenith, size)) return true;
+
+		if (JpegLossless::ProcessFile(inFile, outFile, 0, false, rescale, nadir, zenith, size, fTagged)) return true;
+
+		ImageHeader header;
+		if (!PanoProcessing::ReadImageHeader(inFile, header, false) || !PanoProcessing::IsTooBigToDecode(cv::Size(header.width, header.height))) return false;
+
+		return JpegStream::ProcessFile(inFile, outFile, 0, rescale, nadir, zenith, size, fTagged) ||
+			BigTiff::ProcessFile(inFile, outFile, 0, rescale, nadir, zenith, size, fTagged);
+	};
+
 	//Create the SaveAll dialog that will save everything
 	DialogSaveAll* dialog = new DialogSaveAll(	this,
 												curFolder,
 												nameOnlyArray,
 												saveSubfolderName,
-												//batch save does not rotate, but rescales if needed
-												std::bind(&PanoTwist::ProcessImage, this, _1, false, true),
-												std::bind(&PanoTwist::InsertExifTags, this, _1, _2)
+												processingFunction,
+												&PanoProcessing::InsertExifTags,
+												BatchPipeline::DefaultConfig(),
+												directFunction
 												);
 
 	if (dialog->exec() == QDialog::Accepted)
@@ -493,47 +525,6 @@ void PanoTwist::OnApplyToAllClicked()
 	}
 }
 
-//Fix exif tags after the rotation is done
-void PanoTwist::InsertExifTags(const BString& filename, const cv::Mat& image)
-{
-	Exiv2::ExifData exifData;
-	exifData["Exif.Image.ImageWidth"] = int32_t(image.cols);
-	exifData["Exif.Image.ImageLength"] = int32_t(image.rows);
-
-	Exiv2::XmpData xmpData;
-
-	xmpData["Xmp.GPano.ProjectionType"] = Exiv2::XmpTextValue("equirectangular");
-	xmpData["Xmp.GPano.UsePanoramaViewer"] = true;
-
-	//Cropping - not cropped
-	xmpData["Xmp.GPano.CroppedAreaLeftPixels"] = int32_t(0);
-	xmpData["Xmp.GPano.CroppedAreaTopPixels"] = int32_t(0);
-
-	xmpData["Xmp.GPano.CroppedAreaImageWidthPixels"] = int32_t(image.cols);
-	xmpData["Xmp.GPano.CroppedAreaImageHeightPixels"] = int32_t(image.rows);
-
-	xmpData["Xmp.GPano.FullPanoWidthPixels"] = int32_t(image.cols);
-	xmpData["Xmp.GPano.FullPanoHeightPixels"] = int32_t(image.rows);
-
-	//Pose of the center of the images relative to the true north
-	xmpData["Xmp.GPano.PoseHeadingDegrees"] = 0.0;
-	xmpData["Xmp.GPano.PosePitchDegrees"] = 0.0;
-	xmpData["Xmp.GPano.PoseRollDegrees"] = 0.0;
-
-	//Initial view position
-	xmpData["Xmp.GPano.InitialViewHeadingDegrees"] = int32_t(0);
-	xmpData["Xmp.GPano.InitialViewPitchDegrees"] = int32_t(0);
-	xmpData["Xmp.GPano.InitialViewRollDegrees"] = int32_t(0);
-	
-
-	Exiv2::Image::AutoPtr imageFile = Exiv2::ImageFactory::open(filename);
-	if (!imageFile.get()) return;
-
-	imageFile->setXmpData(xmpData);
-	imageFile->setExifData(exifData);
-	imageFile->writeMetadata();
-}
-
 void PanoTwist::OnNadirZenithChanged()
 {
 	ShowImage();
@@ -559,7 +550,7 @@ void PanoTwist::OnImageMouseMoved(cv::Point2d pos)
 
 	rotationRad = clickRotationRad + diff / double(scaledMat.cols) * 2. * Pi;
 
-	ShowImage();
+	ShowRotation();
 }
 
 void PanoTwist::OnMenuAbout()
@@ -586,52 +577,4 @@ void PanoTwist::OnMenuLicense()
 	dialog->SetMainText("DialogContentL.dld");
 
 	dialog->exec();
-}
-
-// Get the value of the interpolated pixel from the image
-//Image must not be empty
-//And its pixels should be cv::Vec3b
-//Border types specify the handling of the points that are extrapolated outside the image
-cv::Vec3b PanoTwist::InterpolatePixel(const cv::Mat& img, cv::Point2f pt, int borderX, int borderY)
-{
-	int x = (int)pt.x;
-	int y = (int)pt.y;
-
-	int x0 = cv::borderInterpolate(x, img.cols, borderX);
-	int x1 = cv::borderInterpolate(x + 1, img.cols, borderX);
-	int y0 = cv::borderInterpolate(y, img.rows, borderY);
-	int y1 = cv::borderInterpolate(y + 1, img.rows, borderY);
-
-	float a = pt.x - (float)x;
-	float c = pt.y - (float)y;
-
-	uchar b = (uchar)cvRound((img.at<cv::Vec3b>(y0, x0)[0] * (1.f - a) + img.at<cv::Vec3b>(y0, x1)[0] * a) * (1.f - c)
-		+ (img.at<cv::Vec3b>(y1, x0)[0] * (1.f - a) + img.at<cv::Vec3b>(y1, x1)[0] * a) * c);
-	uchar g = (uchar)cvRound((img.at<cv::Vec3b>(y0, x0)[1] * (1.f - a) + img.at<cv::Vec3b>(y0, x1)[1] * a) * (1.f - c)
-		+ (img.at<cv::Vec3b>(y1, x0)[1] * (1.f - a) + img.at<cv::Vec3b>(y1, x1)[1] * a) * c);
-	uchar r = (uchar)cvRound((img.at<cv::Vec3b>(y0, x0)[2] * (1.f - a) + img.at<cv::Vec3b>(y0, x1)[2] * a) * (1.f - c)
-		+ (img.at<cv::Vec3b>(y1, x0)[2] * (1.f - a) + img.at<cv::Vec3b>(y1, x1)[2] * a) * c);
-
-	return cv::Vec3b(b, g, r);
-}
-
-//Performs horizontal right cyclical shift of the matrix
-void PanoTwist::HorizontalCyclicRotate(cv::Mat& mat, int numPixels)
-{
-	//Shift the value of numPixels into the interval [0,mat.cols) as needed
-	numPixels = numPixels % mat.cols;
-	if (numPixels < 0) numPixels += mat.cols;
-
-	if (numPixels == 0) return;
-
-	cv::Mat temp = cv::Mat::zeros(mat.size(), mat.type());
-
-	cv::Rect r0 = cv::Rect(mat.cols - numPixels, 0, numPixels, mat.rows);
-	cv::Rect r1 = cv::Rect(0, 0, numPixels, mat.rows);
-	cv::Rect r2 = cv::Rect(0, 0, mat.cols - numPixels, mat.rows);
-	cv::Rect r3 = cv::Rect(numPixels, 0, mat.cols - numPixels, mat.rows);
-
-	mat(r0).copyTo(temp(r1));
-	mat(r2).copyTo(temp(r3));
-	temp.copyTo(mat);
 }
\ No newline at end of file
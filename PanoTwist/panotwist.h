@@ -28,6 +28,8 @@
 
 #include "NadirZenithWidget.h"
 #include "MaxSizeWidget.h"
+#include "PreviewCache.h"
+#include "PreviewRenderThread.h"
 
 #include <QtWidgets/QMainWindow>
 #include "ui_panotwist.h"
@@ -38,7 +40,7 @@ class PanoTwist : public QMainWindow
 
 public:
 	PanoTwist(QWidget *parent = 0);
-	~PanoTwist(){}
+	~PanoTwist();
 
 public slots:
 	void OnOpenFolderClicked();
@@ -55,25 +57,21 @@ public slots:
 	void OnImageMouseMoved(cv::Point2d pos);
 
 	void OnNadirZenithChanged();
+	void OnPreviewRendered();				//The render thread has a new frame
+
+signals:
+	void SignalPreviewRendered();			//Emitted from the render thread
 
 private:
 	void Init();
 	void UpdateInterface();												//Updates the button state and image based on curIndex
 	bool FileSaveChecks();												//Some checks to make sure we can save the files
-	void ShowImage();													//Show the current scaledImage with crosshairs at the center
-	void ProcessImage(cv::Mat& image, bool fRotate, bool fRescale);		//Applies rotation (if requested) and nadir-zenith modifications to the image
-
-	//Image transformation functions called by the ProcessImage function
-	void InternalPatch(cv::Mat& image, NadirZenithWidget* nzWidget);
-	void InternalRotate(cv::Mat& image);
-	void InternalRescale(cv::Mat& image);
-
-	//OpenCV-based functions for pixel operations
-	cv::Vec3b InterpolatePixel(const cv::Mat& img, cv::Point2f pt, int borderX, int borderY);
-	void HorizontalCyclicRotate(cv::Mat& mat, int numPixels);
-
-	//Inserting exif tags into the processed files
-	void InsertExifTags(const BString& filename, const cv::Mat& image);	//Fix exif tags after the rotation is done
+	void PrefetchNeighbours();											//Starts decoding the previews of the files next to curIndex
+	void ShowImage();													//Requests a new rendering of scaledImage with the current patch settings
+	void ShowRotation();												//Show the current rotation without processing the image again
+	ProcessingSettings CurrentSettings(bool fRotate, bool fRescale);		//Snapshot of the widgets, with rotation and rescaling if requested
+	bool SaveInDctDomain(const BString& filename, const BString& newFileName, const ProcessingSettings& settings, bool& fTagged);	//Rotates and patches a JPEG without decoding all of it, if the settings allow
+	bool SaveInStrips(const BString& filename, const BString& newFileName, const ProcessingSettings& settings, bool& fTagged);		//Processes a JPEG or TIFF too big to decode a strip of rows at a time
 
 private:
 	CvImageWidget* imageWidget;
@@ -89,11 +87,16 @@ private:
 
 	int curIndex;					//The index of the current file in the fileArray
 
-	cv::Mat fullMat;
+	cv::Size fullSize;				//The size of the current file; only the preview is kept in memory
 	cv::Mat scaledMat;
 	cv::Size scaledSize;
 
+	PreviewCache previewCache;		//Previews of the current file and its neighbours
+	PreviewRenderThread previewRenderThread;	//Patches scaledMat for display in the background
+
 	double rotationRad;				//Current accumulated rotation angle in radians
+	int rotatedFirstRow;			//The rows between the patches, which the image widget shifts for the rotation
+	int rotatedLastRow;
 
 	cv::Point2d lastClickCoord;		//the coordinate of a mouse click when dragging the image
 	double clickRotationRad;		//the rotation of the image when the user clicked the mouse to drag the image
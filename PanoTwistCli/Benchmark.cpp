@@ -0,0 +1,757 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+#include "Benchmark.h"
+#include "PanoProcessing.h"
+#include "PreviewRenderer.h"
+#include "JpegLossless.h"
+#include "JpegStream.h"
+#include "BigTiff.h"
+
+#include <QDir>
+#include <QFileInfo>
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+
+namespace
+{
+	//Best of several runs, in milliseconds
+	double TimeMs(std::function<void()> func, int numRuns = 5)
+	{
+		double best = 0;
+		for (int i = 0; i < numRuns; i++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			func();
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			if (i == 0 || ms < best) best = ms;
+		}
+		return best;
+	}
+
+	void PrintResult(const char* name, double oldMs, double newMs, double oldExtraMb, double newExtraMb)
+	{
+		std::cout << std::fixed << std::setprecision(2)
+			<< name << ":\n"
+			<< "  previous: " << std::setw(9) << oldMs << " ms, " << std::setw(9) << oldExtraMb << " MB extra memory\n"
+			<< "  current:  " << std::setw(9) << newMs << " ms, " << std::setw(9) << newExtraMb << " MB extra memory\n"
+			<< "  speedup:  " << std::setw(9) << oldMs / newMs << "x\n";
+	}
+
+	//Rows [firstRow, firstRow + rows.rows) of a panorama-like test image of the given height
+	//Smooth gradients with some texture, no black pixels
+	void SyntheticRows(cv::Mat& rows, int firstRow, int height)
+	{
+		for (int k = 0; k < rows.rows; k++)
+		{
+			int i = firstRow + k;
+			cv::Vec3b* row = rows.ptr<cv::Vec3b>(k);
+			for (int j = 0; j < rows.cols; j++)
+			{
+				row[j] = cv::Vec3b(uchar(1 + (j * 7 + i) % 250), uchar(1 + (int64(i) * 255 / height)), uchar(1 + ((i ^ j) & 127)));
+			}
+		}
+	}
+
+	cv::Mat SyntheticPanorama(int width)
+	{
+		cv::Mat mat(width / 2, width, CV_8UC3);
+		SyntheticRows(mat, 0, mat.rows);
+		return mat;
+	}
+
+	//Nadir and zenith patches of 30 and 15 degrees with the given fills, the color fill is not black
+	void TestPatchSettings(PatchSettings::FillType nadirFill, PatchSettings::FillType zenithFill, PatchSettings& nadir, PatchSettings& zenith)
+	{
+		nadir = PatchSettings();
+		nadir.fEnabled = true;
+		nadir.angleDeg = 30;
+		nadir.fillType = nadirFill;
+		nadir.color = cv::Vec3b(40, 80, 120);
+
+		zenith = PatchSettings();
+		zenith.fEnabled = true;
+		zenith.fNadir = false;
+		zenith.angleDeg = 15;
+		zenith.fillType = zenithFill;
+		zenith.color = cv::Vec3b(40, 80, 120);
+	}
+
+	//HorizontalCyclicRotate as it was before it became in-place, for comparison
+	void PreviousHorizontalCyclicRotate(cv::Mat& mat, int numPixels)
+	{
+		numPixels = numPixels % mat.cols;
+		if (numPixels < 0) numPixels += mat.cols;
+
+		if (numPixels == 0) return;
+
+		cv::Mat temp = cv::Mat::zeros(mat.size(), mat.type());
+
+		cv::Rect r0 = cv::Rect(mat.cols - numPixels, 0, numPixels, mat.rows);
+		cv::Rect r1 = cv::Rect(0, 0, numPixels, mat.rows);
+		cv::Rect r2 = cv::Rect(0, 0, mat.cols - numPixels, mat.rows);
+		cv::Rect r3 = cv::Rect(numPixels, 0, mat.cols - numPixels, mat.rows);
+
+		mat(r0).copyTo(temp(r1));
+		mat(r2).copyTo(temp(r3));
+		temp.copyTo(mat);
+	}
+
+	void BenchmarkRotate(cv::Mat& image)
+	{
+		int shift = image.cols / 3;
+		double mb = 1024. * 1024.;
+
+		double oldMs = TimeMs([&]() { PreviousHorizontalCyclicRotate(image, shift); });
+		double newMs = TimeMs([&]() { PanoProcessing::HorizontalCyclicRotate(image, shift); });
+
+		//The previous version allocated a full-size temporary image
+		//The current one needs the shorter part of one row per worker thread
+		double oldExtra = double(image.total() * image.elemSize()) / mb;
+		double newExtra = double(std::min(shift, image.cols - shift) * image.elemSize()) * cv::getNumThreads() / mb;
+
+		PrintResult("Horizontal cyclic rotate", oldMs, newMs, oldExtra, newExtra);
+	}
+
+	//AddToAverage as it was before the integer SIMD kernel, for comparison
+	void PreviousAddToAverage(const cv::Mat& rows, cv::Vec3d& sum, int64& numPixels)
+	{
+		for (int j = 0; j < rows.rows; j++)
+		{
+			const cv::Vec3b* row = rows.ptr<cv::Vec3b>(j);
+			for (int i = 0; i < rows.cols; i++)
+			{
+				if (row[i](0) > 0 && row[i](1) > 0 && row[i](2) > 0)
+				{
+					numPixels++;
+					sum += cv::Vec3d(row[i]);
+				}
+			}
+		}
+	}
+
+	cv::Vec3b PreviousAverageColor(const cv::Vec3d& sum, int64 numPixels)
+	{
+		if (numPixels == 0) return cv::Vec3b(0, 0, 0);
+
+		double num = double(numPixels);
+		return cv::Vec3b(uchar(sum(0) / num), uchar(sum(1) / num), uchar(sum(2) / num));
+	}
+
+	//Patch as it was before the band was split into tiles of rows, for comparison
+	void PreviousPatch(cv::Mat& image, const PatchSettings& settings)
+	{
+		int bandRows = PanoProcessing::PatchHeight(settings, image.rows);
+		if (bandRows == 0) return;
+
+		cv::Mat dest(image, cv::Rect(0, settings.fNadir ? image.rows - bandRows : 0, image.cols, bandRows));
+		if (settings.fillType == PatchSettings::FillAverage)
+		{
+			cv::Vec3d sum(0, 0, 0);
+			int64 numPixels = 0;
+			PreviousAddToAverage(dest, sum, numPixels);
+
+			dest.setTo(PreviousAverageColor(sum, numPixels));
+		}
+		else PanoProcessing::PatchBandRows(dest, settings, dest.rows, 0);
+	}
+
+	//The sum of the average fill on one thread, with floating-point and with integer SIMD accumulators
+	//Every tenth pixel of the image is given a zero channel, so that the mask is exercised
+	//Returns false if the averages differ
+	bool BenchmarkAverage(const cv::Mat& image)
+	{
+		cv::Mat masked = image.clone();
+		for (int i = 0; i < masked.rows; i++)
+		{
+			cv::Vec3b* row = masked.ptr<cv::Vec3b>(i);
+			for (int j = (i * 7) % 10; j < masked.cols; j += 10) row[j]((i + j) % 3) = 0;
+		}
+
+		cv::Vec3d oldSum;
+		int64 oldPixels = 0;
+		double oldMs = TimeMs([&]()
+		{
+			oldSum = cv::Vec3d(0, 0, 0);
+			oldPixels = 0;
+			PreviousAddToAverage(masked, oldSum, oldPixels);
+		});
+
+		ColorSum newSum;
+		double newMs = TimeMs([&]()
+		{
+			newSum = ColorSum();
+			PanoProcessing::AddToAverage(masked, newSum);
+		});
+
+		//Both only keep the sums
+		PrintResult("Average color sum", oldMs, newMs, 0, 0);
+
+		bool fSame = oldPixels == newSum.numPixels && cv::Scalar(PreviousAverageColor(oldSum, oldPixels)) == PanoProcessing::AverageColor(newSum);
+		std::cout << "  average " << (fSame ? "identical" : "DIFFERENT") << " to the floating-point sum\n";
+		return fSame;
+	}
+
+	//Average and image fills of large bands, on one thread and in tiles of rows on the thread pool
+	//Returns false if the results differ
+	bool BenchmarkPatch(const cv::Mat& image)
+	{
+		PatchSettings nadir;
+		nadir.fEnabled = true;
+		nadir.angleDeg = 60;
+		nadir.fillType = PatchSettings::FillAverage;
+
+		PatchSettings zenith;
+		zenith.fEnabled = true;
+		zenith.fNadir = false;
+		zenith.angleDeg = 60;
+		zenith.fillType = PatchSettings::FillImage;
+		zenith.patchImage = SyntheticPanorama(2048);
+
+		//Patched in place, the average of the band is the same every time after the first run
+		cv::Mat oldResult = image.clone();
+		cv::Mat newResult = image.clone();
+		double oldMs = TimeMs([&]() { PreviousPatch(oldResult, nadir); PreviousPatch(oldResult, zenith); });
+		double newMs = TimeMs([&]() { PanoProcessing::Patch(newResult, nadir); PanoProcessing::Patch(newResult, zenith); });
+
+		//Neither needs more than the image
+		PrintResult("Nadir and zenith patch", oldMs, newMs, 0, 0);
+
+		bool fSame = cv::norm(oldResult, newResult, cv::NORM_INF) == 0;
+		std::cout << "  result " << (fSame ? "identical" : "DIFFERENT") << " to the single-threaded result\n";
+		return fSame;
+	}
+
+	//The fixed-point maps for cv::remap that the image fill used before the bilinear sampler, for comparison
+	void PreviousPatchMaps(cv::Size patchSize, cv::Size bandSize, bool fNadir, cv::Mat& map1, cv::Mat& map2)
+	{
+		int rows = bandSize.height;
+		int cols = bandSize.width;
+
+		int patchXsize = patchSize.width - 1;
+		int patchYsize = patchSize.height - 1;
+		double patchXcenter = double(patchXsize) / 2.;
+		double patchYcenter = double(patchYsize) / 2.;
+		double radius = double(std::min(patchXsize, patchYsize)) / 2.;
+		double dirConst = fNadir ? 1 : -1;
+
+		cv::Mat mapX(rows, cols, CV_32FC1);
+		cv::Mat mapY(rows, cols, CV_32FC1);
+
+		for (int i = 0; i < rows; i++)
+		{
+			double r = (rows > 1) ? double(i) / double(rows - 1) * radius : 0;
+
+			int rowCoord = fNadir ? rows - i - 1 : i;
+			float* xPtr = mapX.ptr<float>(rowCoord);
+			float* yPtr = mapY.ptr<float>(rowCoord);
+
+			for (int j = 0; j < cols; j++)
+			{
+				double phi = double(j) / double(cols) * 2. * CV_PI + CV_PI / 2.;
+				xPtr[j] = float(patchXcenter + r * cos(phi));
+				yPtr[j] = float(patchYcenter + r * dirConst * sin(phi));
+			}
+		}
+
+		cv::convertMaps(mapX, mapY, map1, map2, CV_16SC2);
+	}
+
+	//Image fill of a large band through cv::remap and through the bilinear sampler
+	//Both tables are built beforehand, so only the sampling is timed
+	//Returns false if the bands differ
+	bool BenchmarkPatchImage(const cv::Mat& image)
+	{
+		PatchSettings zenith;
+		zenith.fEnabled = true;
+		zenith.fNadir = false;
+		zenith.angleDeg = 60;
+		zenith.fillType = PatchSettings::FillImage;
+		zenith.patchImage = SyntheticPanorama(2048);
+
+		int bandRows = PanoProcessing::PatchHeight(zenith, image.rows);
+		cv::Mat oldBand(bandRows, image.cols, CV_8UC3);
+		cv::Mat newBand(bandRows, image.cols, CV_8UC3);
+
+		cv::Mat map1, map2;
+		PreviousPatchMaps(zenith.patchImage.size(), newBand.size(), zenith.fNadir, map1, map2);
+		PanoProcessing::PatchBand(newBand, zenith);
+
+		double oldMs = TimeMs([&]() { cv::remap(zenith.patchImage, oldBand, map1, map2, cv::INTER_LINEAR, cv::BORDER_REFLECT_101); });
+		double newMs = TimeMs([&]() { PanoProcessing::PatchBand(newBand, zenith); });
+
+		//The maps take 6 bytes per pixel of the band, the taps 8
+		double mb = 1024. * 1024.;
+		PrintResult("Image patch sampling", oldMs, newMs, bandRows * 6. * image.cols / mb, bandRows * 8. * image.cols / mb);
+
+		bool fSame = cv::norm(oldBand, newBand, cv::NORM_INF) == 0;
+		std::cout << "  result " << (fSame ? "identical" : "DIFFERENT") << " to cv::remap\n";
+		return fSame;
+	}
+
+	//Rescale + rotate + nadir and zenith patches, as separate passes and fused
+	void BenchmarkProcess(const cv::Mat& image)
+	{
+		double rotationRad = 1.0;
+		double mb = 1024. * 1024.;
+
+		RescaleSettings rescale;
+		rescale.fEnabled = true;
+		rescale.maxHeight = image.rows * 3 / 4;
+
+		PatchSettings nadir, zenith;
+		TestPatchSettings(PatchSettings::FillColor, PatchSettings::FillAverage, nadir, zenith);
+
+		cv::Mat result;
+		double oldMs = TimeMs([&]()
+		{
+			image.copyTo(result);
+			PanoProcessing::Rescale(result, rescale);
+			PanoProcessing::Rotate(result, rotationRad);
+			PanoProcessing::Patch(result, nadir);
+			PanoProcessing::Patch(result, zenith);
+		});
+		double newMs = TimeMs([&]() { PanoProcessing::Process(image, result, rotationRad, rescale, nadir, zenith); });
+
+		//Both produce the output image; the separate passes also need a full-size copy of the input
+		double outSize = double(result.total() * result.elemSize()) / mb;
+		double inSize = double(image.total() * image.elemSize()) / mb;
+
+		PrintResult("Rescale + rotate + patch", oldMs, newMs, inSize + outSize, outSize);
+	}
+
+	//A drag in the preview - the rotation changes every frame, the patch settings don't
+	void BenchmarkDrag(const cv::Mat& image)
+	{
+		const int numFrames = 30;
+		double mb = 1024. * 1024.;
+
+		PatchSettings nadir, zenith;
+		TestPatchSettings(PatchSettings::FillAverage, PatchSettings::FillColor, nadir, zenith);
+
+		cv::Mat result;
+		double oldMs = TimeMs([&]()
+		{
+			for (int i = 0; i < numFrames; i++) PanoProcessing::Process(image, result, 0.05 * i, RescaleSettings(), nadir, zenith);
+		}) / numFrames;
+
+		PreviewRenderer renderer;
+		renderer.SetSource(image);
+		double newMs = TimeMs([&]()
+		{
+			for (int i = 0; i < numFrames; i++) result = renderer.Render(0.05 * i, nadir, zenith);
+		}) / numFrames;
+
+		//Both keep the output image; the renderer also keeps the patched bands
+		double outSize = double(result.total() * result.elemSize()) / mb;
+		double bandRows = PanoProcessing::PatchHeight(nadir, image.rows) + PanoProcessing::PatchHeight(zenith, image.rows);
+		double bandSize = bandRows * image.cols * image.elemSize() / mb;
+
+		PrintResult("Preview drag frame", oldMs, newMs, outSize, outSize + bandSize);
+	}
+
+	//Rotating a JPEG file by decoding, shifting and encoding it, and by shifting its DCT blocks
+	//The lossless result is checked against the shifted original, block by block and pixel by pixel
+	//Returns false if the rotated file decodes to different pixels than the decoded and shifted original,
+	//outside the columns next to the seams: with subsampled chroma, libjpeg's upsampling interpolates each pixel
+	//from the neighbouring chroma sample too, which is on the other side of a seam for the one column at each side of it
+	bool BenchmarkLosslessRotate(const cv::Mat& image)
+	{
+		BString srcFilename = QDir::tempPath().toStdString() + "/panotwist-benchmark-src.jpg";
+		BString dstFilename = QDir::tempPath().toStdString() + "/panotwist-benchmark-dst.jpg";
+		double mb = 1024. * 1024.;
+
+		if (!cv::imwrite(srcFilename, image))
+		{
+			std::cout << "Lossless JPEG rotate: could not write " << srcFilename << "\n";
+			return false;
+		}
+
+		cv::Size size;
+		int step = JpegLossless::ColumnStep(srcFilename, size);
+		if (step == 0)
+		{
+			std::cout << "Lossless JPEG rotate: the width is not a multiple of the MCU width, skipped\n";
+			remove(srcFilename.c_str());
+			return true;
+		}
+
+		int shift = image.cols / 3 / step * step;
+
+		double oldMs = TimeMs([&]()
+		{
+			cv::Mat mat = cv::imread(srcFilename, CV_LOAD_IMAGE_COLOR);
+			PanoProcessing::HorizontalCyclicRotate(mat, shift);
+			cv::imwrite(dstFilename, mat);
+		}, 3);
+		double newMs = TimeMs([&]() { JpegLossless::RotateFile(srcFilename, dstFilename, shift, std::vector<std::string>()); }, 3);
+
+		//The decoded image, and the DCT coefficients - 2 bytes each, 1.5 per pixel with 4:2:0 chroma
+		double oldExtra = double(image.total() * image.elemSize()) / mb;
+		double newExtra = double(image.total()) * 3 / mb;
+
+		PrintResult("Lossless JPEG rotate", oldMs, newMs, oldExtra, newExtra);
+
+		bool fBlocksSame = JpegLossless::VerifyRotation(srcFilename, dstFilename, shift);
+
+		cv::Mat expected = cv::imread(srcFilename, CV_LOAD_IMAGE_COLOR);
+		PanoProcessing::HorizontalCyclicRotate(expected, shift);
+		cv::Mat rotated = cv::imread(dstFilename, CV_LOAD_IMAGE_COLOR);
+
+		//The seams are where the left edge of the original ends up and where the rotated image wraps around
+		int cols = image.cols;
+		auto isSeamCol = [&](int j) { return j == shift - 1 || j == shift || j == cols - 1 || j == 0; };
+
+		int numSeamCols = 0;		//Differing columns next to the seams, allowed
+		int numOtherCols = 0;		//Differing columns anywhere else, a failure
+		if (rotated.size() != expected.size()) numOtherCols = cols;
+		else
+		{
+			//Largest difference in each column and channel, then in each column
+			cv::Mat diff, colMax;
+			cv::absdiff(rotated, expected, diff);
+			cv::reduce(diff.reshape(1, diff.rows), colMax, 0, CV_REDUCE_MAX);
+			cv::reduce(colMax.reshape(1, diff.cols), colMax, 1, CV_REDUCE_MAX);
+
+			for (int j = 0; j < cols; j++)
+			{
+				if (colMax.at<uchar>(j) == 0) continue;
+				if (isSeamCol(j)) numSeamCols++;
+				else numOtherCols++;
+			}
+		}
+
+		bool fPassed = fBlocksSame && numOtherCols == 0;
+
+		std::cout << "  DCT blocks " << (fBlocksSame ? "identical" : "DIFFERENT") << " to the shifted original\n"
+			<< "  pixels " << (numOtherCols == 0 ? "identical" : "DIFFERENT") << " to the decoded and shifted original";
+		if (numOtherCols > 0) std::cout << " in " << numOtherCols << " columns away from the seams";
+		std::cout << "; " << numSeamCols << " of the 4 columns next to the seams differ by chroma upsampling, which is allowed\n";
+		if (!fPassed) std::cout << "  FAILED: the lossless rotation is not exact\n";
+
+		remove(srcFilename.c_str());
+		remove(dstFilename.c_str());
+		return fPassed;
+	}
+
+	//Patching nadir and zenith of a JPEG file by decoding and encoding all of it, and only the MCU rows of the patches
+	void BenchmarkPartialPatch(const cv::Mat& image)
+	{
+		BString srcFilename = QDir::tempPath().toStdString() + "/panotwist-benchmark-src.jpg";
+		BString dstFilename = QDir::tempPath().toStdString() + "/panotwist-benchmark-dst.jpg";
+		double mb = 1024. * 1024.;
+
+		PatchSettings nadir, zenith;
+		TestPatchSettings(PatchSettings::FillAverage, PatchSettings::FillColor, nadir, zenith);
+
+		if (!cv::imwrite(srcFilename, image))
+		{
+			std::cout << "Partial JPEG patch: could not write " << srcFilename << "\n";
+			return;
+		}
+
+		double oldMs = TimeMs([&]()
+		{
+			cv::Mat mat = cv::imread(srcFilename, CV_LOAD_IMAGE_COLOR);
+			PanoProcessing::Process(mat, mat, 0, RescaleSettings(), nadir, zenith);
+			cv::imwrite(dstFilename, mat);
+		}, 3);
+
+		bool fDone = true;
+		double newMs = TimeMs([&]() { fDone = JpegLossless::PatchFile(srcFilename, dstFilename, 0, nadir, zenith, std::vector<std::string>()); }, 3);
+
+		//The decoded image, and the file in and out plus the strips of the patches as pixels and coefficients
+		double bandRows = PanoProcessing::PatchHeight(nadir, image.rows) + PanoProcessing::PatchHeight(zenith, image.rows);
+		double fileBytes = double(QFileInfo(QString::fromStdString(srcFilename)).size());
+		double oldExtra = double(image.total() * image.elemSize()) / mb;
+		double newExtra = (fileBytes * 2 + bandRows * image.cols * image.elemSize() * 3) / mb;
+
+		if (fDone) PrintResult("Partial JPEG patch", oldMs, newMs, oldExtra, newExtra);
+		else std::cout << "Partial JPEG patch: the file could not be patched in the DCT domain\n";
+
+		remove(srcFilename.c_str());
+		remove(dstFilename.c_str());
+	}
+
+	//Processing a JPEG file as a whole image and in strips of rows; the results must decode to the same pixels
+	//The files themselves differ: the strip writer adds the panorama tags, cv::imwrite writes none
+	//Returns false if the pixels differ or the file could not be processed in strips
+	bool BenchmarkStream(const cv::Mat& image)
+	{
+		BString srcFilename = QDir::tempPath().toStdString() + "/panotwist-benchmark-src.jpg";
+		BString wholeFilename = QDir::tempPath().toStdString() + "/panotwist-benchmark-whole.jpg";
+		BString stripsFilename = QDir::tempPath().toStdString() + "/panotwist-benchmark-strips.jpg";
+		double rotationRad = 1.0;
+		double mb = 1024. * 1024.;
+
+		PatchSettings nadir, zenith;
+		TestPatchSettings(PatchSettings::FillAverage, PatchSettings::FillColor, nadir, zenith);
+
+		if (!cv::imwrite(srcFilename, image))
+		{
+			std::cout << "Streamed JPEG processing: could not write " << srcFilename << "\n";
+			return false;
+		}
+
+		double oldMs = TimeMs([&]()
+		{
+			cv::Mat mat = cv::imread(srcFilename, CV_LOAD_IMAGE_COLOR);
+			PanoProcessing::Process(mat, mat, rotationRad, RescaleSettings(), nadir, zenith);
+			cv::imwrite(wholeFilename, mat);
+		}, 3);
+
+		bool fDone = true;
+		cv::Size size;
+		bool fTagged;
+		double newMs = TimeMs([&]()
+		{
+			fDone = JpegStream::ProcessFile(srcFilename, stripsFilename, rotationRad, RescaleSettings(), nadir, zenith, size, fTagged);
+		}, 3);
+
+		//The decoded image and its processed copy, against a few strips of 64 rows
+		double imageSize = double(image.total() * image.elemSize()) / mb;
+		double stripsSize = 4. * 64 * image.cols * image.elemSize() / mb;
+
+		bool fSame = false;
+		if (fDone)
+		{
+			PrintResult("Streamed JPEG processing", oldMs, newMs, imageSize * 2, stripsSize);
+
+			cv::Mat whole = cv::imread(wholeFilename, CV_LOAD_IMAGE_COLOR);
+			cv::Mat strips = cv::imread(stripsFilename, CV_LOAD_IMAGE_COLOR);
+			fSame = !whole.empty() && whole.size() == strips.size() && cv::norm(whole, strips, cv::NORM_INF) == 0;
+			std::cout << "  result " << (fSame ? "identical" : "DIFFERENT") << " to the whole-image result\n";
+		}
+		else std::cout << "Streamed JPEG processing: the file could not be processed in strips\n";
+
+		remove(srcFilename.c_str());
+		remove(wholeFilename.c_str());
+		remove(stripsFilename.c_str());
+		return fSame;
+	}
+
+	//Adding the panorama tags to a JPEG that needs no pixel changes, by decoding and encoding it and by copying its data
+	//Returns false if the copy decodes to different pixels or could not be made
+	bool BenchmarkTagsOnly(const cv::Mat& image)
+	{
+		BString srcFilename = QDir::tempPath().toStdString() + "/panotwist-benchmark-src.jpg";
+		BString dstFilename = QDir::tempPath().toStdString() + "/panotwist-benchmark-dst.jpg";
+		double mb = 1024. * 1024.;
+
+		if (!cv::imwrite(srcFilename, image))
+		{
+			std::cout << "Tags only: could not write " << srcFilename << "\n";
+			return false;
+		}
+
+		double oldMs = TimeMs([&]()
+		{
+			cv::Mat mat = cv::imread(srcFilename, CV_LOAD_IMAGE_COLOR);
+			bool fTagged;
+			PanoProcessing::WriteWithExifTags(dstFilename, mat, fTagged);
+		}, 3);
+
+		bool fDone = true;
+		cv::Size size;
+		double newMs = TimeMs([&]()
+		{
+			fDone = PanoProcessing::CopyWithExifTags(srcFilename, dstFilename, 0, false, RescaleSettings(), PatchSettings(), PatchSettings(), size);
+		}, 3);
+
+		//The decoded image and its encoded file, against the file read and rewritten by Exiv2
+		double fileBytes = double(QFileInfo(QString::fromStdString(srcFilename)).size());
+		double oldExtra = (double(image.total() * image.elemSize()) + fileBytes) / mb;
+		double newExtra = fileBytes * 2 / mb;
+
+		bool fSame = false;
+		if (fDone)
+		{
+			PrintResult("Tags only", oldMs, newMs, oldExtra, newExtra);
+
+			//The compressed data is copied, so the pixels must not change at all
+			cv::Mat src = cv::imread(srcFilename, CV_LOAD_IMAGE_COLOR);
+			cv::Mat dst = cv::imread(dstFilename, CV_LOAD_IMAGE_COLOR);
+			fSame = !src.empty() && src.size() == dst.size() && cv::norm(src, dst, cv::NORM_INF) == 0;
+			std::cout << "  pixels " << (fSame ? "identical" : "DIFFERENT") << " to the original\n";
+		}
+		else std::cout << "Tags only: the file could not be copied with the tags\n";
+
+		remove(srcFilename.c_str());
+		remove(dstFilename.c_str());
+		return fSame;
+	}
+
+	//Processing an uncompressed TIFF as a whole image and in strips of rows
+	//The source is generated and written a strip at a time, and the result is checked a strip at a time,
+	//so this also runs on panoramas that don't fit in memory, where it is the only benchmark
+	//Returns false if the result differs from the expected rows or could not be made
+	bool BenchmarkBigTiff(int width)
+	{
+		BString srcFilename = QDir::tempPath().toStdString() + "/panotwist-benchmark-src.tif";
+		BString wholeFilename = QDir::tempPath().toStdString() + "/panotwist-benchmark-whole.tif";
+		BString stripsFilename = QDir::tempPath().toStdString() + "/panotwist-benchmark-strips.tif";
+		const int stripRows = 64;
+		cv::Size size(width, width / 2);
+		double rotationRad = 1.0;
+		double mb = 1024. * 1024.;
+
+		PatchSettings nadir, zenith;
+		TestPatchSettings(PatchSettings::FillColor, PatchSettings::FillAverage, nadir, zenith);
+
+		BigTiff::Writer writer;
+		bool fWritten = writer.Open(srcFilename, size, std::string());
+		cv::Mat rows;
+		for (int i = 0; fWritten && i < size.height; i += stripRows)
+		{
+			rows.create(std::min(stripRows, size.height - i), size.width, CV_8UC3);
+			SyntheticRows(rows, i, size.height);
+			fWritten = writer.WriteRows(rows);
+		}
+
+		if (!fWritten || !writer.Close())
+		{
+			std::cout << "Streamed TIFF processing: could not write " << srcFilename << "\n";
+			return false;
+		}
+
+		bool fDone = true;
+		cv::Size outSize;
+		bool fTagged;
+		double newMs = TimeMs([&]()
+		{
+			fDone = BigTiff::ProcessFile(srcFilename, stripsFilename, rotationRad, RescaleSettings(), nadir, zenith, outSize, fTagged);
+		}, 1);
+
+		//The decoded image and its processed copy, against a few strips of rows
+		double imageSize = double(size.width) * size.height * 3 / mb;
+		double stripsSize = 4. * stripRows * size.width * 3 / mb;
+
+		if (!fDone)
+		{
+			std::cout << "Streamed TIFF processing: the file could not be processed in strips\n";
+		}
+		else if (PanoProcessing::IsTooBigToDecode(size))
+		{
+			std::cout << std::fixed << std::setprecision(2)
+				<< "Streamed TIFF processing:\n"
+				<< "  previous: cv::imread refuses images of more than 2^30 pixels\n"
+				<< "  current:  " << std::setw(9) << newMs << " ms, " << std::setw(9) << stripsSize << " MB extra memory\n";
+		}
+		else
+		{
+			double oldMs = TimeMs([&]()
+			{
+				cv::Mat mat = cv::imread(srcFilename, CV_LOAD_IMAGE_COLOR);
+				PanoProcessing::Process(mat, mat, rotationRad, RescaleSettings(), nadir, zenith);
+				cv::imwrite(wholeFilename, mat);
+			}, 1);
+
+			PrintResult("Streamed TIFF processing", oldMs, newMs, imageSize * 2, stripsSize);
+		}
+
+		bool fSame = false;
+		if (fDone)
+		{
+			//The zenith is filled with the average of its rows, which the rotation does not change
+			int zenithRows = PanoProcessing::PatchHeight(zenith, size.height);
+			int nadirStart = size.height - PanoProcessing::PatchHeight(nadir, size.height);
+			ColorSum sum;
+			for (int i = 0; i < zenithRows; i += stripRows)
+			{
+				rows.create(std::min(stripRows, zenithRows - i), size.width, CV_8UC3);
+				SyntheticRows(rows, i, size.height);
+				PanoProcessing::AddToAverage(rows, sum);
+			}
+
+			cv::Mat zenithRow(1, size.width, CV_8UC3);
+			cv::Mat nadirRow(1, size.width, CV_8UC3);
+			zenithRow.setTo(PanoProcessing::AverageColor(sum));
+			nadirRow.setTo(nadir.color);
+
+			//Every row of the result against the shifted synthetic rows and the fills
+			BigTiff::Reader reader;
+			fSame = reader.Open(stripsFilename) && reader.Size() == size;
+			size_t rowBytes = size_t(size.width) * 3;
+			cv::Mat result;
+
+			for (int i = 0; fSame && i < size.height; i += stripRows)
+			{
+				int numRows = std::min(stripRows, size.height - i);
+				result.create(numRows, size.width, CV_8UC3);
+				rows.create(numRows, size.width, CV_8UC3);
+				fSame = reader.ReadRows(result);
+
+				SyntheticRows(rows, i, size.height);
+				PanoProcessing::Rotate(rows, rotationRad);
+
+				for (int k = 0; fSame && k < numRows; k++)
+				{
+					const uchar* expected = (i + k < zenithRows) ? zenithRow.ptr(0) : (i + k >= nadirStart) ? nadirRow.ptr(0) : rows.ptr(k);
+					fSame = memcmp(result.ptr(k), expected, rowBytes) == 0;
+				}
+			}
+
+			double fileSize = double(QFileInfo(QString::fromStdString(stripsFilename)).size()) / mb;
+			std::cout << "  result " << (fSame ? "identical" : "DIFFERENT") << " to the expected rows, "
+				<< fileSize << " MB" << (fileSize >= 4096 ? " BigTIFF" : " TIFF") << " file\n";
+		}
+
+		remove(srcFilename.c_str());
+		remove(wholeFilename.c_str());
+		remove(stripsFilename.c_str());
+		return fSame;
+	}
+}
+
+bool Benchmark::RunAll(int width)
+{
+	if (width < 2) width = 2;
+	width -= width % 2;
+
+	std::cout << "Benchmarking on a synthetic " << width << " x " << width / 2 << " panorama, "
+		<< cv::getNumThreads() << " threads\n";
+
+	//The other benchmarks need the whole image, and compare with cv::imread, which refuses panoramas this big
+	if (PanoProcessing::IsTooBigToDecode(cv::Size(width, width / 2))) return BenchmarkBigTiff(width);
+
+	cv::Mat image = SyntheticPanorama(width);
+
+	//Every benchmark runs after a failed check too, so that all the results are printed
+	bool fPassed = true;
+
+	BenchmarkRotate(image);
+	fPassed &= BenchmarkAverage(image);
+	fPassed &= BenchmarkPatch(image);
+	fPassed &= BenchmarkPatchImage(image);
+	BenchmarkProcess(image);
+	BenchmarkDrag(image);
+	fPassed &= BenchmarkLosslessRotate(image);
+	BenchmarkPartialPatch(image);
+	fPassed &= BenchmarkStream(image);
+	fPassed &= BenchmarkTagsOnly(image);
+	fPassed &= BenchmarkBigTiff(width);
+
+	return fPassed;
+}
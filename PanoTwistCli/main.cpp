@@ -0,0 +1,381 @@
+/* Copyright (c) 2018 Peter Kondratyuk. All Rights Reserved.
+*
+* You may use, distribute and modify the code in this file under the terms of the MIT Open Source license, however
+* if this file is included as part of a larger project, the project as a whole may be distributed under a different
+* license.
+*
+* MIT license:
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+* documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+* to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions
+* of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+* TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+* CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+//panotwist-cli: headless batch processing of equirectangular panoramas
+//Uses the same processing functions as the PanoTwist interface, but does not need a display
+
+#include "PanoProcessing.h"
+#include "JpegLossless.h"
+#include "JpegStream.h"
+#include "BigTiff.h"
+#include "BatchPipeline.h"
+#include "Benchmark.h"
+#include "Array.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QStringList>
+
+#include <atomic>
+#include <mutex>
+#include <iostream>
+#include <cstdlib>
+
+namespace
+{
+	struct CliOptions
+	{
+		CliOptions() : rotationDeg(0), numThreads(0), benchmarkWidth(0), fSnap(false), fVirtualRotation(false), fStream(false), fQuiet(false) { nadir.fNadir = true; zenith.fNadir = false; }
+
+		CHArray<BString> inputs;		//Folders and files given on the command line
+		BString outputFolder;			//Empty - "Panotwist output/" subfolder next to each input file
+		double rotationDeg;
+		PatchSettings nadir;
+		PatchSettings zenith;
+		RescaleSettings rescale;
+		int numThreads;					//Cores to use, 0 - all of them
+		int benchmarkWidth;				//Run the benchmarks instead of processing files if > 0
+		bool fSnap;						//Round the rotation of JPEGs to whole MCU columns, so they can be rotated losslessly
+		bool fVirtualRotation;			//Rotate by turning the initial view in the GPano tags, when nothing else changes the pixels
+		bool fStream;					//Decode and encode JPEGs and TIFFs in strips of rows instead of whole images
+		bool fQuiet;
+	};
+
+	void PrintUsage()
+	{
+		std::cout <<
+			"Usage: panotwist-cli [options] <folder | file>...\n"
+			"       panotwist-cli --benchmark <width>\n"
+			"\n"
+			"Processes equirectangular panoramas (width == 2 * height) in the given folders and files.\n"
+			"Results are written to the \"Panotwist output\" subfolder next to the originals, unless -o is given.\n"
+			"\n"
+			"Options:\n"
+			"  -o, --output <folder>      Write all results to this folder\n"
+			"  -l, --list <file>          Read additional input files from a text file, one per line\n"
+			"  -r, --rotate <degrees>     Rotate panoramas in azimuth (positive - to the right)\n"
+			"  --nadir <spec>             Patch nadir, see below\n"
+			"  --zenith <spec>            Patch zenith, see below\n"
+			"  --max-height <pixels>      Downscale panoramas taller than this to 2*height x height\n"
+			"  --snap                     Round the rotation of JPEGs to 8 or 16 pixel steps, so that they can be\n"
+			"                             rotated losslessly when no rescaling applies\n"
+			"  --virtual-rotation         Record the rotation as the initial view heading in the GPano tags and copy\n"
+			"                             the image data as it is, for panoramas that need no patching or rescaling\n"
+			"  --stream                   Process JPEGs and uncompressed TIFFs in strips of rows, so that panoramas\n"
+			"                             of any height fit in memory; always done for more than 2^30 pixels\n"
+			"  -j, --threads <n>          Number of cores to use (default: all)\n"
+			"  -q, --quiet                Only report errors\n"
+			"  --benchmark <width>        Time the processing kernels on a synthetic width x width/2 panorama\n"
+			"  -h, --help                 Show this message\n"
+			"\n"
+			"Patch spec is <angle>[:average | :color=#RRGGBB | :image=<file>], for example\n"
+			"  --nadir 25                 fill 25 degrees around nadir with the average color\n"
+			"  --zenith 15:color=#66D9FF  fill 15 degrees around zenith with a color\n"
+			"  --nadir 30:image=logo.png  fill 30 degrees around nadir with an image\n";
+	}
+
+	//Parses <angle>[:average | :color=#RRGGBB | :image=<file>]
+	bool ParsePatchSpec(const BString& spec, PatchSettings& settings, BString& error)
+	{
+		BString angleString = spec;
+		BString fillString;
+
+		int colonPos = spec.Find(':');
+		if (colonPos >= 0)
+		{
+			angleString = spec.Left(colonPos);
+			fillString = spec.Mid(colonPos + 1);
+		}
+
+		char* end = nullptr;
+		settings.angleDeg = strtod(angleString.c_str(), &end);
+		if (angleString.IsEmpty() || *end != 0 || settings.angleDeg <= 0 || settings.angleDeg > 90)
+		{
+			error = "Patch angle must be a number between 0 and 90 degrees: " + spec;
+			return false;
+		}
+
+		settings.fEnabled = true;
+
+		if (fillString.IsEmpty() || fillString == "average")
+		{
+			settings.fillType = PatchSettings::FillAverage;
+		}
+		else if (fillString.Left(6) == "color=")
+		{
+			settings.fillType = PatchSettings::FillColor;
+			if (!PanoProcessing::ParseColorString(fillString.Mid(6), settings.color))
+			{
+				error = "Invalid patch color, expected #RRGGBB: " + spec;
+				return false;
+			}
+		}
+		else if (fillString.Left(6) == "image=")
+		{
+			settings.fillType = PatchSettings::FillImage;
+			settings.patchImage = cv::imread(fillString.Mid(6), CV_LOAD_IMAGE_COLOR);
+			if (settings.patchImage.empty())
+			{
+				error = "Failed to open patch image " + fillString.Mid(6);
+				return false;
+			}
+		}
+		else
+		{
+			error = "Unknown patch fill type: " + spec;
+			return false;
+		}
+
+		return true;
+	}
+
+	//Returns false if the arguments are invalid or help was requested
+	bool ParseArguments(int argc, char* argv[], CliOptions& options)
+	{
+		BString error;
+
+		for (int i = 1; i < argc; i++)
+		{
+			BString arg = argv[i];
+
+			if (arg == "-h" || arg == "--help") { PrintUsage(); return false; }
+			if (arg == "-q" || arg == "--quiet") { options.fQuiet = true; continue; }
+			if (arg == "--snap") { options.fSnap = true; continue; }
+			if (arg == "--virtual-rotation") { options.fVirtualRotation = true; continue; }
+			if (arg == "--stream") { options.fStream = true; continue; }
+
+			if (arg.GetLength() > 1 && arg[0] == '-')
+			{
+				//All other options take a value
+				if (i + 1 >= argc)
+				{
+					std::cerr << "Missing value for option " << arg << "\n";
+					return false;
+				}
+				BString value = argv[++i];
+
+				if (arg == "-o" || arg == "--output")
+				{
+					options.outputFolder = QDir::fromNativeSeparators(value.c_str()).toStdString();
+					if (options.outputFolder.Right(1) != "/") options.outputFolder += "/";
+				}
+				else if (arg == "-l" || arg == "--list")
+				{
+					CHArray<BString> listed;
+					if (!listed.ReadStrings(value))
+					{
+						std::cerr << "Could not read file list " << value << "\n";
+						return false;
+					}
+					for (auto& name : listed) if (!name.Trim().IsEmpty()) options.inputs << name;
+				}
+				else if (arg == "-r" || arg == "--rotate") options.rotationDeg = atof(value);
+				else if (arg == "--max-height")
+				{
+					options.rescale.fEnabled = true;
+					options.rescale.maxHeight = atoi(value);
+					if (options.rescale.maxHeight <= 0)
+					{
+						std::cerr << "Invalid maximum height " << value << "\n";
+						return false;
+					}
+				}
+				else if (arg == "-j" || arg == "--threads") options.numThreads = atoi(value);
+				else if (arg == "--benchmark") options.benchmarkWidth = atoi(value);
+				else if (arg == "--nadir" || arg == "--zenith")
+				{
+					PatchSettings& settings = (arg == "--nadir") ? options.nadir : options.zenith;
+					if (!ParsePatchSpec(value, settings, error))
+					{
+						std::cerr << error << "\n";
+						return false;
+					}
+				}
+				else
+				{
+					std::cerr << "Unknown option " << arg << "\n";
+					return false;
+				}
+				continue;
+			}
+
+			options.inputs << arg;
+		}
+
+		if (options.inputs.Count() == 0 && options.benchmarkWidth <= 0)
+		{
+			PrintUsage();
+			return false;
+		}
+
+		return true;
+	}
+
+	//Expands folders into the JPEG and TIFF files they contain
+	//And pairs every input file with its output file name
+	void CollectFiles(const CliOptions& options, CHArray<BString>& inFiles, CHArray<BString>& outFiles)
+	{
+		const BString saveSubfolderName = "Panotwist output/";
+
+		for (auto& input : options.inputs)
+		{
+			QFileInfo info(input.c_str());
+
+			if (info.isDir())
+			{
+				QDir dir(info.absoluteFilePath());
+
+				QStringList filters;
+				filters << "*.jpg" << "*.jpeg" << "*.tif" << "*.tiff";
+				dir.setNameFilters(filters);
+				dir.setFilter(QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks);
+
+				BString folder = dir.absolutePath().toStdString() + "/";
+				BString outFolder = options.outputFolder;
+				if (outFolder.IsEmpty()) outFolder = folder + saveSubfolderName;
+
+				for (auto& fileName : dir.entryList())
+				{
+					inFiles << folder + fileName.toStdString();
+					outFiles << outFolder + fileName.toStdString();
+				}
+			}
+			else
+			{
+				BString folder = info.absolutePath().toStdString() + "/";
+				BString outFolder = options.outputFolder;
+				if (outFolder.IsEmpty()) outFolder = folder + saveSubfolderName;
+
+				inFiles << folder + info.fileName().toStdString();
+				outFiles << outFolder + info.fileName().toStdString();
+			}
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	CliOptions options;
+	if (!ParseArguments(argc, argv, options)) return 2;
+
+	PanoProcessing::InitializeMetadataThreading();
+
+	if (options.benchmarkWidth > 0)
+	{
+		if (options.numThreads > 0) cv::setNumThreads(options.numThreads);
+		return Benchmark::RunAll(options.benchmarkWidth) ? 0 : 1;
+	}
+
+	CHArray<BString> inFiles, outFiles;
+	CollectFiles(options, inFiles, outFiles);
+
+	if (inFiles.Count() == 0)
+	{
+		std::cerr << "No JPEG or TIFF files found.\n";
+		return 1;
+	}
+
+	//Create the output folders before any of the workers start writing
+	for (auto& outFile : outFiles) QDir().mkpath(QFileInfo(outFile.c_str()).absolutePath());
+
+	const double Pi = 3.1415926535897932;
+	double rotationRad = options.rotationDeg / 180.0 * Pi;
+
+	//The processors share this and only read it
+	ProcessingSettings settings;
+	settings.rotationRad = rotationRad;
+	settings.rescale = options.rescale;
+	settings.nadir = options.nadir;
+	settings.zenith = options.zenith;
+
+	//Skips images that are not equirectangular panoramas
+	auto processingFunction = [&settings](cv::Mat& mat) -> bool
+	{
+		if (!PanoProcessing::IsEquirectangular(mat.cols, mat.rows)) return false;
+
+		PanoProcessing::Process(mat, mat, settings);
+		return true;
+	};
+
+	//Panoramas whose pixels stay as they are only get the tags, the rest of the file is copied without decoding it
+	//With --virtual-rotation, this includes the rotated ones; the others are still rotated by moving their pixels
+	//JPEG panoramas that need no rescaling are rotated and patched in the DCT domain, without decoding all of them
+	//With --stream, and for panoramas too big for cv::imread, the other JPEGs and uncompressed TIFFs are processed in strips
+	//Files that are not panoramas are left to the pipeline, which skips them
+	auto directFunction = [&](const BString& inFile, const BString& outFile, bool& fTagged) -> bool
+	{
+		ImageHeader header;
+		if (!PanoProcessing::ReadImageHeader(inFile, header, false) || !PanoProcessing::IsEquirectangular(header.width, header.height)) return false;
+
+		bool fStrips = options.fStream || PanoProcessing::IsTooBigToDecode(cv::Size(header.width, header.height));
+
+		//The writers add the tags themselves, so the file is written once
+		cv::Size size;
+		fTagged = true;
+		if (PanoProcessing::CopyWithExifTags(inFile, outFile, rotationRad, options.fVirtualRotation, options.rescale, options.nadir, options.zenith, size)) return true;
+
+		return JpegLossless::ProcessFile(inFile, outFile, rotationRad, options.fSnap, options.rescale, options.nadir, options.zenith, size, fTagged) ||
+			(fStrips && JpegStream::ProcessFile(inFile, outFile, rotationRad, options.rescale, options.nadir, options.zenith, size, fTagged)) ||
+			(fStrips && BigTiff::ProcessFile(inFile, outFile, rotationRad, options.rescale, options.nadir, options.zenith, size, fTagged));
+	};
+
+	int numSaved = 0;
+	int numFailed = 0;
+	std::mutex outputMutex;
+	std::atomic<bool> fCancel(false);
+
+	BatchPipeline pipeline(BatchPipeline::DefaultConfig(options.numThreads), processingFunction, &PanoProcessing::InsertExifTags);
+	pipeline.SetDirectFunction(directFunction);
+
+	pipeline.Run(inFiles, outFiles, fCancel,
+		[&](int index, BatchPipeline::FileStatus status, const cv::Mat& mat)
+	{
+		std::lock_guard<std::mutex> lock(outputMutex);
+
+		switch (status)
+		{
+		case BatchPipeline::Saved:
+			numSaved++;
+			if (!options.fQuiet) std::cout << "Saved " << outFiles[index] << "\n";
+			break;
+		case BatchPipeline::TagFailed:
+			numSaved++;
+			if (!options.fQuiet) std::cout << "Saved " << outFiles[index] << " (could not write panorama tags)\n";
+			break;
+		case BatchPipeline::Skipped:
+			if (!options.fQuiet) std::cout << "Skipped " << inFiles[index] << " - not an equirectangular panorama\n";
+			break;
+		case BatchPipeline::ReadFailed:
+			numFailed++;
+			std::cerr << "Could not read " << inFiles[index] << "\n";
+			break;
+		case BatchPipeline::WriteFailed:
+			numFailed++;
+			std::cerr << "Could not write " << outFiles[index] << "\n";
+			break;
+		}
+	});
+
+	if (!options.fQuiet) std::cout << numSaved << " of " << inFiles.Count() << " files saved.\n";
+
+	return (numFailed > 0) ? 1 : 0;
+}